@@ -84,6 +84,28 @@ function sort_key_expr(key, prefix, rename) {
     }
 }
 
+const condition_ops = ['=', '!=', '<', '<=', '>', '>='];
+
+// Same checks as query_config.hpp. Names only support = and != since PostgreSQL orders them as text, but RocksDB by value.
+function check_conditions(query) {
+    const conditions = query.conditions || [];
+    for (let c of conditions) {
+        const field = tables[query.table].fields[c.name];
+        if (!field)
+            throw new Error(`query ${query.short_name}: unknown condition field: ${c.name}`);
+        if (!condition_ops.includes(c.op))
+            throw new Error(`query ${query.short_name}: unknown condition op: ${c.op}`);
+        if (field.type === 'name' && c.op !== '=' && c.op !== '!=')
+            throw new Error(`query ${query.short_name}: condition on name field ${c.name} only supports = and !=`);
+    }
+    return conditions;
+}
+
+// Conditions from query-config.json, as SQL. Rows which fail them don't count against max_results.
+function condition_sql(conditions, prefix) {
+    return conditions.map(c => `${prefix}"${c.name}" ${c.op} '${c.value.replace(/'/g, "''")}'`).join(' and ');
+}
+
 function generate_index({ table, index, sort_keys, history_keys }) {
     if (!index)
         return;
@@ -96,11 +118,12 @@ function generate_index({ table, index, sort_keys, history_keys }) {
 
 // todo: This likely needs reoptimization.
 // todo: perf problem with low snapshot_block_num
-function generate_nonstate({ table, index, has_block_snapshot, sort_keys, ...rest }) {
+function generate_nonstate({ table, index, has_block_snapshot, sort_keys, conditions, ...rest }) {
     const fn_name = schema + '.' + rest['function'];
     const fn_args = prefix => sort_keys.map(x => `${prefix}${x.name} ${x.type},`).join('\n            ');
     const sort_keys_tuple = (prefix, suffix, sep) => sort_keys.map(x => `${prefix}${x.name}${suffix}`).join(sep);
     const sort_keys_tuple_expr = prefix => sort_keys.map(x => sort_key_expr(x, prefix, false)).join(',');
+    const conds = condition_sql(conditions, `${table}.`);
 
     const key_search = indent => `
         ${indent}for search in
@@ -110,7 +133,7 @@ function generate_nonstate({ table, index, has_block_snapshot, sort_keys, ...res
         ${indent}        ${schema}.${table}
         ${indent}    where
         ${indent}        (${sort_keys_tuple_expr('')}) >= (${sort_keys_tuple('"arg_first_', '"', ', ')})
-        ${indent}        ${has_block_snapshot ? `and ${table}.block_num <= snapshot_block_num` : ``}
+        ${indent}        ${has_block_snapshot ? `and ${table}.block_num <= snapshot_block_num` : ``}${conds ? ` and ${conds}` : ``}
         ${indent}    order by
         ${indent}        ${sort_keys_tuple_expr('')}
         ${indent}    limit max_results
@@ -142,12 +165,17 @@ function generate_nonstate({ table, index, has_block_snapshot, sort_keys, ...res
     `;
 } // generate
 
-function generate_state({ table, index, has_block_snapshot, keys, sort_keys, history_keys, ordered_fields, join, join_key_values, fields_from_join, ...rest }) {
+function generate_state({ table, index, has_block_snapshot, keys, sort_keys, history_keys, ordered_fields, join, join_key_values, fields_from_join, conditions, ...rest }) {
     const fn_name = schema + '.' + rest['function'];
     const fn_args = prefix => sort_keys.map(x => `${prefix}${x.name} ${x.type},`).join('\n            ');
     const sort_keys_tuple = (prefix, suffix, sep) => sort_keys.map(x => `${prefix}${x.name}${suffix}`).join(sep);
     const sort_keys_tuple_expr = sort_keys.map(x => sort_key_expr(x, `${table}.`, true)).join(',');
 
+    // conditions apply to the output row, after not-present rows and join fields are filled in
+    const conds = condition_sql(conditions, '');
+    const return_next = conds ? `if ${conds} then return next; end if;` : `return next;`;
+    const count_result = conds ? `if ${conds} then num_results = num_results + 1; end if;` : `num_results = num_results + 1;`;
+
     let keys_by_name = {};
     for (let key of [...keys, ...history_keys])
         keys_by_name[key.name] = key;
@@ -156,7 +184,7 @@ function generate_state({ table, index, has_block_snapshot, keys, sort_keys, his
 
     const non_joined = (compare, indent) => `
         ${indent}            ${ordered_fields.map(f => `"${f.name}" = block_search."${f.name}";`).join('\n                    ' + indent)}
-        ${indent}            return next;
+        ${indent}            ${return_next}
     `;
 
     const joined = (compare, indent) => `
@@ -178,13 +206,13 @@ function generate_state({ table, index, has_block_snapshot, keys, sort_keys, his
         ${indent}                    found_join_block = true;
         ${indent}                    ${ordered_fields.map(f => `"${f.name}" = block_search."${f.name}";`).join('\n                            ' + indent)}
         ${indent}                    ${fields_from_join.map(f => `"${f.join_new_name}" = join_block_search."${f.name}";`).join('\n                            ' + indent)}
-        ${indent}                    return next;
+        ${indent}                    ${return_next}
         ${indent}                end if;
         ${indent}            end loop;
         ${indent}            if not found_join_block then
         ${indent}                ${ordered_fields.map(f => `"${f.name}" = block_search."${f.name}";`).join('\n                        ' + indent)}
         ${indent}                ${fields_from_join.map(f => `"${f.join_new_name}" = ${empty_value_map[f.type] + '::' + type_map[f.type]};`).join('\n                        ' + indent)}
-        ${indent}                return next;
+        ${indent}                ${return_next}
         ${indent}            end if;
     `;
 
@@ -228,9 +256,9 @@ function generate_state({ table, index, has_block_snapshot, keys, sort_keys, his
         ${indent}            ${keys.map(f => `"${f.name}" = key_search."${f.name}";`).join('\n                    ' + indent)}
         ${indent}            ${data_fields.map(f => `"${f.name}" = ${empty_value_map[f.type] + '::' + type_map[f.type]};`).join('\n                    ' + indent)}
         ${indent}            ${fields_from_join.map(f => `"${f.join_new_name}" = ${empty_value_map[f.type] + '::' + type_map[f.type]};`).join('\n                    ' + indent)}
-        ${indent}            return next;
+        ${indent}            ${return_next}
         ${indent}        end if;
-        ${indent}        num_results = num_results + 1;
+        ${indent}        ${count_result}
         ${indent}        found_block = true;
         ${indent}    end loop;
         ${indent}    if not found_block then
@@ -239,8 +267,8 @@ function generate_state({ table, index, has_block_snapshot, keys, sort_keys, his
         ${indent}        ${keys.map(f => `"${f.name}" = key_search."${f.name}";`).join('\n                ' + indent)}
         ${indent}        ${data_fields.map(f => `"${f.name}" = ${empty_value_map[f.type] + '::' + type_map[f.type]};`).join('\n                ' + indent)}
         ${indent}        ${fields_from_join.map(f => `"${f.join_new_name}" = ${empty_value_map[f.type] + '::' + type_map[f.type]};`).join('\n                ' + indent)}
-        ${indent}        return next;
-        ${indent}        num_results = num_results + 1;
+        ${indent}        ${return_next}
+        ${indent}        ${count_result}
         ${indent}    end if;
         ${indent}end loop;
     `;
@@ -338,6 +366,7 @@ for (let query of config.queries) {
         ordered_fields: tables[query.table].ordered_fields,
         join_key_values: (query.join_key_values || []).map(({ name, expression }) => ({ name, expression, type: tables[query.join].fields[name].type })),
         fields_from_join: (query.fields_from_join || []).map(({ name, join_new_name }) => ({ name, join_new_name, type: tables[query.join].fields[name].type })),
+        conditions: check_conditions(query),
     };
     fill_types(query, query.keys);
     fill_types(query, query.sort_keys);
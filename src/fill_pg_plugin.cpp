@@ -14,7 +14,16 @@
 #include <boost/beast/websocket.hpp>
 #include <fc/exception/exception.hpp>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <libpq-fe.h>
+#include <mutex>
 #include <pqxx/tablewriter>
+#include <set>
+#include <thread>
+#include <unordered_map>
 
 using namespace abieos;
 using namespace appbase;
@@ -40,16 +49,283 @@ struct table_stream {
         , writer(t, name) {}
 };
 
+// COPY ... FROM STDIN (FORMAT binary). pqxx's tablewriter only handles text lines, so this talks to libpq directly. Rows are
+// gathered into chunks; each stream feeds its chunks to the server from its own thread, through a bounded queue, so tables load
+// concurrently.
+struct binary_table_stream {
+    static constexpr size_t chunk_size = 1024 * 1024;
+    static constexpr size_t max_queue  = 8;
+
+    PGconn*                       c      = nullptr;
+    std::vector<char>             buffer = {}; // rows written from the session thread
+    std::mutex                    mutex;
+    std::condition_variable       cv;
+    std::deque<std::vector<char>> queue = {};
+    bool                          done  = false;
+    std::exception_ptr            error = {};
+    std::thread                   thread;
+
+    binary_table_stream(const std::string& name) {
+        c = PQconnectdb("");
+        if (PQstatus(c) != CONNECTION_OK) {
+            std::string msg = PQerrorMessage(c);
+            PQfinish(c);
+            throw std::runtime_error("binary copy: " + msg);
+        }
+        auto* r      = PQexec(c, ("copy " + name + " from stdin with (format binary)").c_str());
+        auto  status = PQresultStatus(r);
+        PQclear(r);
+        if (status != PGRES_COPY_IN) {
+            std::string msg = PQerrorMessage(c);
+            PQfinish(c);
+            throw std::runtime_error("binary copy: " + msg);
+        }
+        // The header must be the first thing sent; encoder threads push() chunks directly, bypassing buffer
+        queue.emplace_back(binary_copy_header, binary_copy_header + sizeof(binary_copy_header) - 1);
+        thread = std::thread([this] { run(); });
+    }
+
+    binary_table_stream(const binary_table_stream&) = delete;
+    binary_table_stream& operator=(const binary_table_stream&) = delete;
+
+    ~binary_table_stream() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.clear();
+        }
+        finish_thread();
+        PQfinish(c);
+    }
+
+    void write(const std::vector<char>& row) {
+        buffer.insert(buffer.end(), row.begin(), row.end());
+        if (buffer.size() >= chunk_size) {
+            push(std::move(buffer));
+            buffer.clear();
+        }
+    }
+
+    // Thread safe. chunk must hold whole rows.
+    void push(std::vector<char>&& chunk) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return queue.size() < max_queue || error; });
+        if (error)
+            std::rethrow_exception(error);
+        queue.push_back(std::move(chunk));
+        cv.notify_all();
+    }
+
+    void run() {
+        while (true) {
+            std::vector<char> chunk;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return !queue.empty() || done; });
+                if (queue.empty())
+                    return;
+                chunk = std::move(queue.front());
+                queue.pop_front();
+                cv.notify_all();
+            }
+            if (PQputCopyData(c, chunk.data(), chunk.size()) != 1) {
+                std::lock_guard<std::mutex> lock(mutex);
+                error = std::make_exception_ptr(std::runtime_error("binary copy: "s + PQerrorMessage(c)));
+                queue.clear();
+                cv.notify_all();
+                return;
+            }
+        }
+    }
+
+    void finish_thread() {
+        if (!thread.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+
+    // Queues the trailer; the thread exits once everything has been sent
+    void finish() {
+        push_binary<int16_t>(buffer, -1);
+        push(std::move(buffer));
+        buffer.clear();
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        cv.notify_all();
+    }
+
+    void complete() {
+        finish_thread();
+        if (error)
+            std::rethrow_exception(error);
+        if (PQputCopyEnd(c, nullptr) != 1)
+            throw std::runtime_error("binary copy: "s + PQerrorMessage(c));
+        bool ok = true;
+        while (auto* r = PQgetResult(c)) {
+            ok = ok && PQresultStatus(r) == PGRES_COMMAND_OK;
+            PQclear(r);
+        }
+        if (!ok)
+            throw std::runtime_error("binary copy: "s + PQerrorMessage(c));
+    }
+};
+
+// Encodes bulk rows off the session thread. post() blocks while the backlog is full; wait() blocks until every posted task
+// finished and rethrows the first failure.
+struct encoder_pool {
+    std::mutex                        mutex;
+    std::condition_variable           cv;
+    std::deque<std::function<void()>> tasks    = {};
+    uint32_t                          busy     = 0;
+    bool                              stopping = false;
+    std::exception_ptr                error    = {};
+    std::vector<std::thread>          threads  = {};
+
+    encoder_pool(uint32_t num_threads) {
+        for (uint32_t i = 0; i < num_threads; ++i)
+            threads.emplace_back([this] { run(); });
+    }
+
+    encoder_pool(const encoder_pool&) = delete;
+    encoder_pool& operator=(const encoder_pool&) = delete;
+
+    ~encoder_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.clear();
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    void post(std::function<void()> f) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return tasks.size() < 2 * threads.size() || error; });
+        if (error)
+            return;
+        tasks.push_back(std::move(f));
+        cv.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return tasks.empty() && !busy; });
+        if (error)
+            std::rethrow_exception(std::exchange(error, nullptr));
+    }
+
+    void run() {
+        while (true) {
+            std::function<void()> f;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return !tasks.empty() || stopping; });
+                if (stopping)
+                    return;
+                f = std::move(tasks.front());
+                tasks.pop_front();
+                ++busy;
+                cv.notify_all();
+            }
+            try {
+                f();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+                tasks.clear();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            --busy;
+            cv.notify_all();
+        }
+    }
+};
+
+// How to encode an ABI field, resolved once per ABI so rows don't look up sql types by name
+struct field_encoder {
+    enum kind_type {
+        scalar,
+        nested_struct,
+        nested_variant, // variant holding a single struct
+        optional_struct,
+        struct_array,
+        variant_array, // array of variants holding a single struct
+    };
+
+    kind_type                  kind          = scalar;
+    std::string                name          = {};
+    std::string                abi_type_name = {};
+    const type*                sql_type      = nullptr; // scalar
+    bool                       is_optional   = false;   // scalar
+    std::string                element_type  = {};      // arrays: struct name, which is also the composite type's name
+    std::vector<field_encoder> fields        = {};      // everything except scalar
+};
+
+struct delta_table {
+    const abi_type*            variant_type = nullptr;
+    std::vector<field_encoder> fields       = {};
+    table_filter               filter       = {};
+};
+
+struct trim_table {
+    std::string              name   = {};
+    std::vector<std::string> keys   = {};
+    bool                     simple = false; // no keys to preserve; delete the whole range
+};
+
+struct composite_type {
+    uint32_t              oid        = 0;
+    std::vector<uint32_t> field_oids = {};
+};
+
+// A table's prepared insert and the live rows waiting for it. Each column is an array literal which is bound to one of the
+// statement's text[] parameters.
+struct table_insert {
+    std::string              statement   = {};
+    size_t                   num_columns = 0;
+    std::vector<std::string> columns     = {}; // empty until the block's first row
+    size_t                   size        = 0;
+};
+
+// Text rows are always built in COPY text form. Bulk rows are streamed as is; write() splits live rows into the columns
+// of the table's prepared insert.
+static constexpr bool copy_text = true;
+
+// Tables with one set of rows per block, as opposed to the contract and chain state tables
+static const char* const simple_tables[] = {
+    "received_block",
+    "action_trace_authorization",
+    "action_trace_auth_sequence",
+    "action_trace_ram_delta",
+    "action_trace",
+    "transaction_trace",
+    "block_info",
+};
+
 struct fpg_session;
 
 struct fill_postgresql_config : connection_config {
-    std::string             schema;
-    uint32_t                skip_to       = 0;
-    uint32_t                stop_before   = 0;
-    std::vector<trx_filter> trx_filters   = {};
-    bool                    drop_schema   = false;
-    bool                    create_schema = false;
-    bool                    enable_trim   = false;
+    std::string               schema;
+    uint32_t                  skip_to        = 0;
+    uint32_t                  stop_before    = 0;
+    std::vector<trx_filter>   trx_filters    = {};
+    std::vector<delta_filter> delta_filters  = {};
+    bool                      drop_schema    = false;
+    bool                      create_schema  = false;
+    bool                      enable_trim    = false;
+    bool                      text_copy      = false;
+    uint32_t                  copy_threads   = 0;
+    uint32_t                  trim_threads   = 0;
+    uint32_t                  partition_size = 0;
+    bool                      catch_up       = false;
+    uint32_t                  sync_interval  = 0;
 };
 
 struct fill_postgresql_plugin_impl : std::enable_shared_from_this<fill_postgresql_plugin_impl> {
@@ -74,18 +350,34 @@ struct fill_postgresql_plugin_impl : std::enable_shared_from_this<fill_postgresq
 };
 
 struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_session> {
-    fill_postgresql_plugin_impl*                         my = nullptr;
-    std::shared_ptr<fill_postgresql_config>              config;
-    std::optional<pqxx::connection>                      sql_connection;
-    std::shared_ptr<state_history::connection>           connection;
-    bool                                                 created_trim    = false;
-    uint32_t                                             head            = 0;
-    std::string                                          head_id         = "";
-    uint32_t                                             irreversible    = 0;
-    std::string                                          irreversible_id = "";
-    uint32_t                                             first           = 0;
-    uint32_t                                             first_bulk      = 0;
-    std::map<std::string, std::unique_ptr<table_stream>> table_streams;
+    fill_postgresql_plugin_impl*                                my = nullptr;
+    std::shared_ptr<fill_postgresql_config>                     config;
+    std::optional<pqxx::connection>                             sql_connection;
+    std::shared_ptr<state_history::connection>                  connection;
+    bool                                                        created_trim    = false;
+    uint32_t                                                    head            = 0;
+    std::string                                                 head_id         = "";
+    uint32_t                                                    irreversible    = 0;
+    std::string                                                 irreversible_id = "";
+    uint32_t                                                    first           = 0;
+    uint32_t                                                    first_bulk      = 0;
+    std::map<std::string, std::unique_ptr<table_stream>>        table_streams;
+    std::map<std::string, std::unique_ptr<binary_table_stream>> binary_table_streams;
+    std::map<std::string, composite_type>                       composite_types;
+    const abi_type*                                             table_delta_type = nullptr;
+    std::vector<delta_table>                                    delta_tables;
+    std::unordered_map<std::string, uint32_t>                   delta_table_ids; // index into delta_tables
+    std::vector<char>                                           binary_row;
+    std::vector<trim_table>                                     trim_tables;
+    std::map<std::string, std::set<uint32_t>>                   partitions; // first block of each partition, by table
+    std::optional<uint32_t>                                     ensured_partition;
+    bool                                                        catching_up = false;
+    uint32_t                                                    synced_head = 0;
+    bool                                                        in_block    = false;
+    std::string                                                 row_values;
+    std::map<std::string, table_insert>                         table_inserts;
+    bool                                                        prepared_statements = false;
+    std::unique_ptr<encoder_pool>                               encoders; // destroyed before the streams its tasks write to
 
     fpg_session(fill_postgresql_plugin_impl* my)
         : my(my)
@@ -93,6 +385,10 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
 
         ilog("connect to postgresql");
         sql_connection.emplace();
+        if (config->sync_interval)
+            sql_connection->set_variable("synchronous_commit", "off");
+        if (!config->text_copy && config->copy_threads)
+            encoders = std::make_unique<encoder_pool>(config->copy_threads);
     }
 
     void start(asio::io_context& ioc) {
@@ -109,17 +405,132 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
     }
 
     void received_abi(std::string_view abi) override {
+        init_delta_tables();
         if (config->create_schema) {
             create_tables();
             config->create_schema = false;
         }
+        prepare_statements();
         connection->send(get_status_request_v0{});
     }
 
+    field_encoder make_encoder(const abi_field& field) {
+        field_encoder result;
+        result.name          = field.name;
+        result.abi_type_name = field.type->name;
+        auto add_fields      = [&](const std::vector<abi_field>& fields) {
+            for (auto& f : fields)
+                result.fields.push_back(make_encoder(f));
+        };
+
+        if (field.type->filled_struct) {
+            result.kind = field_encoder::nested_struct;
+            add_fields(field.type->fields);
+        } else if (field.type->optional_of && field.type->optional_of->filled_struct) {
+            result.kind = field_encoder::optional_struct;
+            add_fields(field.type->optional_of->fields);
+        } else if (field.type->filled_variant && field.type->fields.size() == 1 && field.type->fields[0].type->filled_struct) {
+            result.kind = field_encoder::nested_variant;
+            add_fields(field.type->fields[0].type->fields);
+        } else if (field.type->array_of && field.type->array_of->filled_struct) {
+            result.kind         = field_encoder::struct_array;
+            result.element_type = field.type->array_of->name;
+            add_fields(field.type->array_of->fields);
+        } else if (field.type->array_of && field.type->array_of->filled_variant && field.type->array_of->fields[0].type->filled_struct) {
+            result.kind         = field_encoder::variant_array;
+            result.element_type = field.type->array_of->fields[0].type->name;
+            add_fields(field.type->array_of->fields[0].type->fields);
+        } else {
+            auto abi_type = field.type->name;
+            if (abi_type.size() >= 1 && abi_type.back() == '?') {
+                result.is_optional = true;
+                abi_type.resize(abi_type.size() - 1);
+            }
+            auto it = abi_type_to_sql_type.find(abi_type);
+            if (it == abi_type_to_sql_type.end())
+                throw std::runtime_error("don't know sql type for abi type: " + abi_type);
+            result.sql_type = &it->second;
+        }
+        return result;
+    }
+
+    void init_delta_tables() {
+        table_delta_type = &get_type("table_delta");
+        delta_tables.clear();
+        delta_table_ids.clear();
+        for (auto& table : connection->abi.tables) {
+            if (table.type == "global_property")
+                continue;
+            auto& variant_type = get_type(table.type);
+            if (!variant_type.filled_variant || variant_type.fields.size() != 1 || !variant_type.fields[0].type->filled_struct)
+                throw std::runtime_error("don't know how to proccess " + variant_type.name);
+            delta_table dt;
+            dt.variant_type = &variant_type;
+            dt.filter       = get_table_filter(config->delta_filters, table.name);
+            for (auto& field : variant_type.fields[0].type->fields)
+                dt.fields.push_back(make_encoder(field));
+            delta_table_ids[table.name] = delta_tables.size();
+            delta_tables.push_back(std::move(dt));
+        }
+    }
+
+    // Statements which run once per block. Executed with "execute" since pqxx::pipeline only takes query strings.
+    void prepare_statements() {
+        if (prepared_statements)
+            return;
+        pqxx::work t(*sql_connection);
+        t.exec(
+            "prepare write_fill_status(bigint, varchar, bigint, varchar, bigint) as update " + t.quote_name(config->schema) +
+            ".fill_status set head=$1, head_id=$2, irreversible=$3, irreversible_id=$4, first=$5");
+        t.exec(
+            "prepare write_received_block(bigint, varchar) as insert into " + t.quote_name(config->schema) +
+            ".received_block (block_num, block_id) values ($1, $2)");
+        prepare_inserts(t);
+        t.commit();
+        prepared_statements = true;
+    }
+
+    // One insert per table for live rows. Every column is bound as a text[] and cast back to its type after unnest(); typed
+    // array parameters can't carry the array columns since postgres has no arrays of arrays. Partitioned tables are
+    // inserted through the parent.
+    void prepare_inserts(pqxx::work& t) {
+        table_inserts.clear();
+        auto rows = t.exec(
+            "select c.relname, format_type(a.atttypid, a.atttypmod) from pg_class c join pg_attribute a on a.attrelid = c.oid "
+            "where c.relnamespace = " +
+            t.quote(t.quote_name(config->schema)) +
+            "::regnamespace and c.relkind in ('r', 'p') and not c.relispartition and c.relname not in ('fill_status', "
+            "'received_block') and a.attnum > 0 and not a.attisdropped order by c.relname, a.attnum");
+        std::map<std::string, std::vector<std::string>> column_types;
+        for (auto row : rows)
+            column_types[row[0].as<std::string>()].push_back(row[1].as<std::string>());
+        for (auto& [name, types] : column_types) {
+            std::string params, args, columns, values;
+            for (size_t i = 0; i < types.size(); ++i) {
+                auto comma = i ? ", " : "";
+                auto col   = "c" + std::to_string(i + 1);
+                params += comma + "text[]"s;
+                args += comma + "$"s + std::to_string(i + 1);
+                columns += comma + col;
+                values += comma + col + "::" + types[i];
+            }
+            auto& insert       = table_inserts[name];
+            insert.statement   = t.quote_name("insert_" + name);
+            insert.num_columns = types.size();
+            t.exec(
+                "prepare " + insert.statement + "(" + params + ") as insert into " + t.quote_name(config->schema) + "." +
+                t.quote_name(name) + " select " + values + " from unnest(" + args + ") as u(" + columns + ")");
+        }
+    } // prepare_inserts
+
     bool received(get_status_result_v0& status) override {
         pqxx::work t(*sql_connection);
         load_fill_status(t);
-        auto           positions = get_positions(t);
+        check_partitioning(t);
+        check_catch_up(t);
+        auto positions = get_positions(t);
+        if (!config->text_copy)
+            load_composite_types(t);
         pqxx::pipeline pipeline(t);
         truncate(t, pipeline, head + 1);
         pipeline.complete();
@@ -162,7 +573,8 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         if (suffix_fields)
             fields += ","s + suffix_fields;
         std::string query =
-            "create table " + t.quote_name(config->schema) + "." + t.quote_name(name) + "(" + fields + ", primary key (" + pk + "))";
+            "create table " + t.quote_name(config->schema) + "." + t.quote_name(name) + "(" + fields + ", primary key (" + pk + "))" +
+            partition_clause();
         t.exec(query);
     }
 
@@ -209,6 +621,8 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         }
     }; // fill_field
 
+    std::string partition_clause() { return config->partition_size ? " partition by range (block_num)" : ""; }
+
     void create_tables() {
         pqxx::work t(*sql_connection);
 
@@ -219,7 +633,7 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
             ".transaction_status_type as enum('executed', 'soft_fail', 'hard_fail', 'delayed', 'expired')");
         t.exec(
             "create table " + t.quote_name(config->schema) +
-            R"(.received_block ("block_num" bigint, "block_id" varchar(64), primary key("block_num")))");
+            R"(.received_block ("block_num" bigint, "block_id" varchar(64), primary key("block_num")))" + partition_clause());
         t.exec(
             "create table " + t.quote_name(config->schema) +
             R"(.fill_status ("head" bigint, "head_id" varchar(64), "irreversible" bigint, "irreversible_id" varchar(64), "first" bigint))");
@@ -247,8 +661,8 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
             std::string keys = "block_num, present";
             for (auto& key : table.key_names)
                 keys += ", " + t.quote_name(key);
-            std::string query =
-                "create table " + t.quote_name(config->schema) + "." + table.type + "(" + fields + ", primary key(" + keys + "))";
+            std::string query = "create table " + t.quote_name(config->schema) + "." + table.type + "(" + fields + ", primary key(" +
+                                keys + "))" + partition_clause();
             t.exec(query);
         }
 
@@ -265,16 +679,14 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
                 "action_mroot" varchar(64),
                 "schedule_version" bigint,
                 "new_producers_version" bigint,
-                primary key("block_num")))");
+                primary key("block_num")))" +
+            partition_clause());
 
         t.commit();
     } // create_tables()
 
-    void create_trim() {
-        if (created_trim)
-            return;
-        pqxx::work t(*sql_connection);
-        ilog("create_trim");
+    std::vector<std::string> trim_indexes(pqxx::work& t) {
+        std::vector<std::string> result;
         for (auto& table : connection->abi.tables) {
             if (table.type == "global_property")
                 continue;
@@ -287,115 +699,35 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
             for (auto& k : table.key_names)
                 query += "    " + t.quote_name(k) + ",\n";
             query += "    \"block_num\" desc,\n    \"present\" desc\n)";
-            // std::cout << query << ";\n\n";
-            t.exec(query);
+            result.push_back(std::move(query));
         }
+        return result;
+    }
 
-        std::string query = R"(
-            drop function if exists )" +
-                            t.quote_name(config->schema) + R"(.trim_history;
-        )";
-        // std::cout << query << "\n";
-        t.exec(query);
-
-        query = R"(
-            create function )" +
-                t.quote_name(config->schema) + R"(.trim_history(
-                prev_block_num bigint,
-                irrev_block_num bigint
-            ) returns void
-            as $$
-                declare
-                    key_search record;
-                begin)";
-
-        static const char* const simple_cases[] = {
-            "received_block",
-            "action_trace_authorization",
-            "action_trace_auth_sequence",
-            "action_trace_ram_delta",
-            "action_trace",
-            "transaction_trace",
-            "block_info",
-        };
-
-        for (const char* table : simple_cases) {
-            query += R"(
-                    delete from )" +
-                     t.quote_name(config->schema) + "." + t.quote_name(table) + R"(
-                    where
-                        block_num >= prev_block_num
-                        and block_num < irrev_block_num;
-                    )";
-        }
-
-        auto add_trim = [&](const std::string& table, const std::string& keys, const std::string& search_keys) {
-            query += R"(
-                    for key_search in
-                        select
-                            distinct on()" +
-                     keys + R"()
-                            )" +
-                     keys + R"(, block_num
-                        from
-                            )" +
-                     t.quote_name(config->schema) + "." + t.quote_name(table) + R"(
-                        where
-                            block_num > prev_block_num and block_num <= irrev_block_num
-                        order by )" +
-                     keys + R"(, block_num desc, present desc
-                    loop
-                        delete from )" +
-                     t.quote_name(config->schema) + "." + t.quote_name(table) + R"(
-                        where
-                            ()" +
-                     keys + R"() = ()" + search_keys + R"()
-                            and block_num < key_search.block_num;
-                    end loop;
-                    )";
-        };
+    void create_trim() {
+        if (created_trim)
+            return;
+        pqxx::work t(*sql_connection);
+        ilog("create_trim");
+        for (auto& query : trim_indexes(t))
+            t.exec(query);
 
+        trim_tables.clear();
+        for (const char* table : simple_tables)
+            trim_tables.push_back({table, {}, true});
         for (auto& table : connection->abi.tables) {
             if (table.type == "global_property")
                 continue;
-            if (table.key_names.empty()) {
-                query += R"(
-                    for key_search in
-                        select
-                            block_num
-                        from
-                            )" +
-                         t.quote_name(config->schema) + "." + t.quote_name(table.type) + R"(
-                        where
-                            block_num > prev_block_num and block_num <= irrev_block_num
-                        order by block_num desc, present desc
-                        limit 1
-                    loop
-                        delete from )" +
-                         t.quote_name(config->schema) + "." + t.quote_name(table.type) + R"(
-                        where
-                            block_num < key_search.block_num;
-                    end loop;
-                    )";
-            } else {
-                std::string keys, search_keys;
-                for (auto& k : table.key_names) {
-                    if (&k != &table.key_names.front()) {
-                        keys += ", ";
-                        search_keys += ", ";
-                    }
-                    keys += t.quote_name(k);
-                    search_keys += "key_search." + t.quote_name(k);
-                }
-                add_trim(table.type, keys, search_keys);
-            };
+            trim_tables.push_back({table.type, table.key_names, false});
         }
-        query += R"(
-                end 
-            $$ language plpgsql;
-        )";
 
-        // std::cout << query << "\n\n";
+        // trim() runs the same statements directly, one table per connection; the function remains for manual use
+        t.exec("drop function if exists " + t.quote_name(config->schema) + ".trim_history");
+        std::string query = "create function " + t.quote_name(config->schema) +
+                            ".trim_history(prev_block_num bigint, irrev_block_num bigint) returns void as $$ begin\n";
+        for (auto& table : trim_tables)
+            query += "    " + trim_query(t, table, "prev_block_num", "irrev_block_num") + ";\n";
+        query += "end $$ language plpgsql";
         t.exec(query);
         t.commit();
         created_trim = true;
@@ -409,6 +741,28 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         irreversible    = r[2].as<uint32_t>();
         irreversible_id = r[3].as<std::string>();
         first           = r[4].as<uint32_t>();
+        synced_head     = head;
+    }
+
+    // binary copy needs the oids of the array element types and of their fields
+    void load_composite_types(pqxx::work& t) {
+        composite_types.clear();
+        auto rows = t.exec(
+            "select t.typname, t.oid, a.atttypid from pg_type t join pg_class c on c.oid = t.typrelid join pg_attribute a on "
+            "a.attrelid = c.oid where c.relkind = 'c' and t.typnamespace = " +
+            t.quote(t.quote_name(config->schema)) + "::regnamespace and a.attnum > 0 and not a.attisdropped order by t.typname, a.attnum");
+        for (auto row : rows) {
+            auto& type = composite_types[row[0].as<std::string>()];
+            type.oid   = row[1].as<uint32_t>();
+            type.field_oids.push_back(row[2].as<uint32_t>());
+        }
+    }
+
+    const composite_type& get_composite_type(const std::string& name) {
+        auto it = composite_types.find(name);
+        if (it == composite_types.end())
+            throw std::runtime_error("unknown composite type " + name);
+        return it->second;
     }
 
     std::vector<block_position> get_positions(pqxx::work& t) {
@@ -421,34 +775,228 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         return result;
     }
 
+    // With --fpg-sync-interval, blocks commit asynchronously and only the transactions which advance fill_status wait for the
+    // WAL flush. Async commits are still applied in order, so a crash loses at most the blocks after the last fill_status
+    // update; they're truncated and refetched on restart.
     void write_fill_status(pqxx::work& t, pqxx::pipeline& pipeline) {
-        std::string query = "update " + t.quote_name(config->schema) + ".fill_status set head=" + std::to_string(head) +
-                            ", head_id=" + quote(head_id) + ", ";
+        if (config->sync_interval)
+            pipeline.insert("set local synchronous_commit = on");
+        synced_head = head;
+        std::string query = "execute write_fill_status(" + std::to_string(head) + ", " + t.quote(head_id) + ", ";
         if (irreversible < head)
-            query += "irreversible=" + std::to_string(irreversible) + ", irreversible_id=" + quote(irreversible_id);
+            query += std::to_string(irreversible) + ", " + t.quote(irreversible_id);
         else
-            query += "irreversible=" + std::to_string(head) + ", irreversible_id=" + quote(head_id);
-        query += ", first=" + std::to_string(first);
+            query += std::to_string(head) + ", " + t.quote(head_id);
+        query += ", " + std::to_string(first) + ")";
         pipeline.insert(query);
     }
 
+    bool fill_status_due(bool forked) {
+        return !config->sync_interval || forked || head >= uint64_t(synced_head) + config->sync_interval;
+    }
+
+    void sync_fill_status() {
+        if (!config->sync_interval || head == synced_head)
+            return;
+        pqxx::work     t(*sql_connection);
+        pqxx::pipeline pipeline(t);
+        write_fill_status(t, pipeline);
+        pipeline.complete();
+        t.commit();
+    }
+
+    // Tables which hold the filled data, partitions included. fill_status stays logged.
+    std::vector<std::string> data_tables() {
+        if (!config->partition_size)
+            return block_tables();
+        std::vector<std::string> result;
+        for (auto& [table, starts] : partitions)
+            for (auto start : starts)
+                result.push_back(partition_name(table, start));
+        return result;
+    }
+
+    // While catching up, tables are UNLOGGED and have no secondary indexes. A database crash empties unlogged tables, including
+    // received_block, so the filler then starts over from scratch instead of trusting a head it no longer has.
+    void check_catch_up(pqxx::work& t) {
+        auto rows = t.exec(
+            "select count(*) from pg_class where relnamespace = " + t.quote(t.quote_name(config->schema)) +
+            "::regnamespace and relkind = 'r' and relpersistence = 'u'");
+        catching_up = rows[0][0].as<uint64_t>() > 0;
+        if (catching_up && head) {
+            auto found = t.exec(
+                "select 1 from " + t.quote_name(config->schema) + ".received_block where block_num = " + std::to_string(head));
+            if (found.empty()) {
+                ilog("catch up: unlogged tables were emptied by a database crash; starting over");
+                t.exec(
+                    "update " + t.quote_name(config->schema) +
+                    ".fill_status set head=0, head_id='', irreversible=0, irreversible_id='', first=0");
+                head            = 0;
+                head_id         = "";
+                irreversible    = 0;
+                irreversible_id = "";
+                first           = 0;
+                synced_head     = 0;
+            }
+        }
+        if (catching_up || !config->catch_up || head)
+            return;
+        ilog("catch up: switching to unlogged tables");
+        catching_up = true;
+        for (auto& table : data_tables())
+            t.exec("alter table " + t.quote_name(config->schema) + "." + t.quote_name(table) + " set unlogged");
+    }
+
+    void finish_catch_up() {
+        close_streams();
+        ilog("catch up: switching to logged tables");
+        std::vector<std::string> logged, indexes;
+        {
+            pqxx::work t(*sql_connection);
+            for (auto& table : data_tables())
+                logged.push_back("alter table " + t.quote_name(config->schema) + "." + t.quote_name(table) + " set logged");
+            if (config->enable_trim)
+                indexes = trim_indexes(t);
+        }
+        size_t num_done = 0;
+        exec_parallel(logged, std::max(std::thread::hardware_concurrency(), 1u), [&](size_t, const pqxx::result&) {
+            if (!(++num_done % 10) || num_done == logged.size())
+                ilog("catch up: ${n} of ${c} tables logged", ("n", num_done)("c", logged.size()));
+        });
+
+        // one connection per index
+        num_done = 0;
+        exec_parallel(indexes, indexes.size(), [&](size_t, const pqxx::result&) {
+            ilog("catch up: ${n} of ${c} indexes built", ("n", ++num_done)("c", indexes.size()));
+        });
+        catching_up = false;
+    }
+
+    std::vector<std::string> block_tables() {
+        std::vector<std::string> result(std::begin(simple_tables), std::end(simple_tables));
+        for (auto& table : connection->abi.tables)
+            if (table.type != "global_property")
+                result.push_back(table.type);
+        return result;
+    }
+
+    uint32_t partition_start(uint32_t block_num) { return block_num - block_num % config->partition_size; }
+
+    std::string partition_name(const std::string& table, uint32_t start) { return table + "_" + std::to_string(start); }
+
+    // Where bulk rows for block_num go. COPY targets the partition directly instead of routing through the parent.
+    std::string target_table(const std::string& table, uint32_t block_num) {
+        if (!config->partition_size)
+            return table;
+        return partition_name(table, partition_start(block_num));
+    }
+
+    void check_partitioning(pqxx::work& t) {
+        auto rows = t.exec(
+            "select relkind from pg_class where oid = to_regclass(" + t.quote(t.quote_name(config->schema) + ".block_info") + ")");
+        bool partitioned = !rows.empty() && rows[0][0].as<std::string>() == "p";
+        if (partitioned && !config->partition_size)
+            throw std::runtime_error("tables are partitioned; --fpg-partition-size is required");
+        if (!partitioned && config->partition_size)
+            throw std::runtime_error("--fpg-partition-size needs tables which were created with it");
+        if (partitioned)
+            load_partitions(t);
+    }
+
+    // Partitions are named <table>_<first block>. Their bounds must match --fpg-partition-size, otherwise ensure_partition()
+    // would later create partitions which overlap them.
+    void load_partitions(pqxx::work& t) {
+        partitions.clear();
+        ensured_partition.reset();
+        auto rows = t.exec(
+            "select p.relname, c.relname, pg_get_expr(c.relpartbound, c.oid) from pg_inherits i join pg_class c on c.oid = "
+            "i.inhrelid join pg_class p on p.oid = i.inhparent where p.relnamespace = " +
+            t.quote(t.quote_name(config->schema)) + "::regnamespace");
+        for (auto row : rows) {
+            auto table = row[0].as<std::string>();
+            auto name  = row[1].as<std::string>();
+            auto start = name.substr(std::min(name.size(), table.size() + 1));
+            if (name.compare(0, table.size() + 1, table + "_") || start.empty() ||
+                start.find_first_not_of("0123456789") != std::string::npos)
+                throw std::runtime_error("unexpected partition " + name + " of " + table);
+
+            // e.g. FOR VALUES FROM ('1000000') TO ('2000000')
+            auto                  bound = row[2].as<std::string>();
+            std::vector<uint64_t> values;
+            for (auto pos = bound.find_first_of("0123456789"); pos != std::string::npos; pos = bound.find_first_of("0123456789", pos)) {
+                auto end = bound.find_first_not_of("0123456789", pos);
+                values.push_back(std::stoull(bound.substr(pos, end - pos)));
+                pos = end;
+            }
+            if (values.size() != 2)
+                throw std::runtime_error("partition " + name + " has unexpected bounds: " + bound);
+            if (values[0] != std::stoul(start) || values[1] - values[0] != config->partition_size || values[0] % config->partition_size)
+                throw std::runtime_error(
+                    "partition " + name + " covers blocks " + std::to_string(values[0]) + " - " + std::to_string(values[1] - 1) +
+                    "; --fpg-partition-size is " + std::to_string(config->partition_size) + " but must be " +
+                    std::to_string(values[1] - values[0]) + ", the size the tables were created with");
+            partitions[table].insert(values[0]);
+        }
+    }
+
+    void ensure_partition(uint32_t block_num) {
+        auto start = partition_start(block_num);
+        if (ensured_partition == start)
+            return;
+        std::vector<std::string> missing;
+        for (auto& table : block_tables())
+            if (!partitions[table].count(start))
+                missing.push_back(table);
+        if (!missing.empty()) {
+            // creating a partition locks its parent, which conflicts with the open COPY streams
+            close_streams();
+            pqxx::work t(*sql_connection);
+            auto       end = uint64_t(start) + config->partition_size;
+            for (auto& table : missing) {
+                t.exec(
+                    "create "s + (catching_up ? "unlogged " : "") + "table if not exists " + t.quote_name(config->schema) + "." +
+                    t.quote_name(partition_name(table, start)) + " partition of " + t.quote_name(config->schema) + "." +
+                    t.quote_name(table) + " for values from (" + std::to_string(start) + ") to (" + std::to_string(end) + ")");
+                partitions[table].insert(start);
+            }
+            t.commit();
+            ilog("created partitions for blocks ${b} - ${e}", ("b", start)("e", end - 1));
+        }
+        ensured_partition = start;
+    }
+
+    // Partitions which only hold blocks after block are dropped instead of deleted from. The partition holding block itself
+    // stays; the caller is about to write into it.
+    void drop_partitions_after(pqxx::work& t, pqxx::pipeline& pipeline, uint32_t block) {
+        for (auto& [table, starts] : partitions) {
+            for (auto it = starts.upper_bound(block); it != starts.end(); it = starts.erase(it))
+                pipeline.insert("drop table if exists " + t.quote_name(config->schema) + "." + t.quote_name(partition_name(table, *it)));
+        }
+        ensured_partition.reset();
+    }
+
+    // trim deletes every row of a simple table below the trim point, so their partitions are dropped whole
+    void drop_trimmed_partitions(uint32_t end_trim) {
+        pqxx::work t(*sql_connection);
+        for (const char* table : simple_tables) {
+            auto& starts = partitions[table];
+            while (!starts.empty() && uint64_t(*starts.begin()) + config->partition_size <= end_trim) {
+                t.exec("drop table if exists " + t.quote_name(config->schema) + "." + t.quote_name(partition_name(table, *starts.begin())));
+                starts.erase(starts.begin());
+            }
+        }
+        t.commit();
+    }
+
     void truncate(pqxx::work& t, pqxx::pipeline& pipeline, uint32_t block) {
         auto trunc = [&](const std::string& name) {
             pipeline.insert(
                 "delete from " + t.quote_name(config->schema) + "." + t.quote_name(name) + " where block_num >= " + std::to_string(block));
         };
-        trunc("received_block");
-        trunc("action_trace_authorization");
-        trunc("action_trace_auth_sequence");
-        trunc("action_trace_ram_delta");
-        trunc("action_trace");
-        trunc("transaction_trace");
-        trunc("block_info");
-        for (auto& table : connection->abi.tables) {
-            if (table.type == "global_property")
-                continue;
-            trunc(table.type);
-        }
+        if (config->partition_size)
+            drop_partitions_after(t, pipeline, block);
+        for (auto& name : block_tables())
+            trunc(name);
 
         auto result = pipeline.retrieve(pipeline.insert(
             "select block_id from " + t.quote_name(config->schema) + ".received_block where block_num=" + std::to_string(block - 1)));
@@ -465,6 +1013,7 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
     bool received(get_blocks_result_v0& result) override {
         if (!result.this_block)
             return true;
+        in_block = true;
         bool bulk         = result.this_block->block_num + 4 < result.last_irreversible.block_num;
         bool large_deltas = false;
         if (!bulk && result.deltas && result.deltas->end - result.deltas->pos >= 10 * 1024 * 1024) {
@@ -475,11 +1024,13 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
 
         if (config->stop_before && result.this_block->block_num >= config->stop_before) {
             close_streams();
+            sync_fill_status();
             ilog("block ${b}: stop requested", ("b", result.this_block->block_num));
             return false;
         }
 
-        if (result.this_block->block_num <= head) {
+        bool forked = result.this_block->block_num <= head;
+        if (forked) {
             close_streams();
             ilog("switch forks at block ${b}", ("b", result.this_block->block_num));
             bulk = false;
@@ -487,13 +1038,21 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
 
         if (!bulk || large_deltas || !(result.this_block->block_num % 200))
             close_streams();
-        if (table_streams.empty())
+        if (table_streams.empty() && binary_table_streams.empty())
             trim();
         if (!bulk)
             ilog("block ${b}", ("b", result.this_block->block_num));
+        if (catching_up && !bulk)
+            finish_catch_up();
+        if (config->partition_size)
+            ensure_partition(result.this_block->block_num);
 
         pqxx::work     t(*sql_connection);
         pqxx::pipeline pipeline(t);
+        for (auto& [_, insert] : table_inserts) {
+            insert.columns.clear();
+            insert.size = 0;
+        }
         if (result.this_block->block_num <= head)
             truncate(t, pipeline, result.this_block->block_num);
         if (!head_id.empty() && (!result.prev_block || (std::string)result.prev_block->block_id != head_id))
@@ -511,37 +1070,77 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         irreversible_id = (std::string)result.last_irreversible.block_id;
         if (!first)
             first = head;
-        if (!bulk)
+        flush_inserts(t, pipeline);
+        if (!bulk && fill_status_due(forked))
             write_fill_status(t, pipeline);
         pipeline.insert(
-            "insert into " + t.quote_name(config->schema) + ".received_block (block_num, block_id) values (" +
-            std::to_string(result.this_block->block_num) + ", " + quote(std::string(result.this_block->block_id)) + ")");
+            "execute write_received_block(" + std::to_string(result.this_block->block_num) + ", " +
+            quote(std::string(result.this_block->block_id)) + ")");
 
         pipeline.complete();
         t.commit();
         if (large_deltas)
             close_streams();
+        in_block = false;
         return true;
     } // receive_result()
 
     void write_stream(uint32_t block_num, pqxx::work& t, const std::string& name, const std::string& values) {
         if (!first_bulk)
             first_bulk = block_num;
-        auto& ts = table_streams[name];
+        auto  target = target_table(name, block_num);
+        auto& ts     = table_streams[target];
         if (!ts)
-            ts = std::make_unique<table_stream>(t.quote_name(config->schema) + "." + t.quote_name(name));
+            ts = std::make_unique<table_stream>(t.quote_name(config->schema) + "." + t.quote_name(target));
         ts->writer.write_raw_line(values);
     }
 
+    bool use_binary(bool bulk) { return bulk && !config->text_copy; }
+
+    void begin_binary_row() {
+        binary_row.clear();
+        push_binary<int16_t>(binary_row, 0);
+    }
+
+    template <typename... T>
+    void append_binary_fields(uint32_t& num_fields, const T&... values) {
+        (append_binary(binary_row, values), ...);
+        num_fields += sizeof...(values);
+    }
+
+    binary_table_stream& get_binary_stream(uint32_t block_num, pqxx::work& t, const std::string& name) {
+        if (!first_bulk)
+            first_bulk = block_num;
+        auto  target = target_table(name, block_num);
+        auto& ts     = binary_table_streams[target];
+        if (!ts)
+            ts = std::make_unique<binary_table_stream>(t.quote_name(config->schema) + "." + t.quote_name(target));
+        return *ts;
+    }
+
+    void write_binary(uint32_t block_num, pqxx::work& t, const std::string& name, uint32_t num_fields) {
+        patch_binary<int16_t>(binary_row, 0, num_fields);
+        get_binary_stream(block_num, t, name).write(binary_row);
+    }
+
     void close_streams() {
-        if (table_streams.empty())
+        if (table_streams.empty() && binary_table_streams.empty())
             return;
+        if (encoders)
+            encoders->wait();
         for (auto& [_, ts] : table_streams) {
             ts->writer.complete();
             ts->t.commit();
             ts.reset();
         }
         table_streams.clear();
+        for (auto& [_, ts] : binary_table_streams)
+            ts->finish();
+        for (auto& [_, ts] : binary_table_streams) {
+            ts->complete();
+            ts.reset();
+        }
+        binary_table_streams.clear();
 
         pqxx::work     t(*sql_connection);
         pqxx::pipeline pipeline(t);
@@ -553,126 +1152,166 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         first_bulk = 0;
     }
 
-    void fill_value(
-        bool bulk, bool nested_bulk, pqxx::work& t, const std::string& base_name, std::string& fields, std::string& values,
-        input_buffer& bin, const abi_field& field) {
-        if (field.type->filled_struct) {
-            for (auto& f : field.type->fields)
-                fill_value(bulk, nested_bulk, t, base_name + field.name + "_", fields, values, bin, f);
-        } else if (field.type->optional_of && field.type->optional_of->filled_struct) {
+    void fill_value(bool bulk, bool nested_bulk, pqxx::work& t, std::string& values, input_buffer& bin, const field_encoder& field) {
+        switch (field.kind) {
+        case field_encoder::nested_variant:
+            if (read_varuint32(bin))
+                throw std::runtime_error("invalid variant in " + field.abi_type_name);
+            [[fallthrough]];
+        case field_encoder::nested_struct:
+            for (auto& f : field.fields)
+                fill_value(bulk, nested_bulk, t, values, bin, f);
+            break;
+        case field_encoder::optional_struct: {
             auto present = read_raw<bool>(bin);
-            fields += ", " + t.quote_name(base_name + field.name + "_present");
-            values += sep(bulk) + sql_str(bulk, present);
+            values += sep(bulk);
+            values += sql_str(bulk, present);
             if (present) {
-                for (auto& f : field.type->optional_of->fields)
-                    fill_value(bulk, nested_bulk, t, base_name + field.name + "_", fields, values, bin, f);
+                for (auto& f : field.fields)
+                    fill_value(bulk, nested_bulk, t, values, bin, f);
             } else {
-                for (auto& f : field.type->optional_of->fields) {
-                    auto it = abi_type_to_sql_type.find(f.type->name);
-                    if (it == abi_type_to_sql_type.end())
-                        throw std::runtime_error("don't know sql type for abi type: " + f.type->name);
-                    if (!it->second.empty_to_sql)
-                        throw std::runtime_error("don't know how to process empty " + field.type->name);
-                    fields += ", " + t.quote_name(base_name + field.name + "_" + f.name);
-                    values += sep(bulk) + it->second.empty_to_sql(*sql_connection, bulk);
+                for (auto& f : field.fields) {
+                    if (!f.sql_type || !f.sql_type->empty_to_sql)
+                        throw std::runtime_error("don't know how to process empty " + field.abi_type_name);
+                    values += sep(bulk);
+                    values += f.sql_type->empty_to_sql(*sql_connection, bulk);
                 }
             }
-        } else if (field.type->filled_variant && field.type->fields.size() == 1 && field.type->fields[0].type->filled_struct) {
-            auto v = read_varuint32(bin);
-            if (v)
-                throw std::runtime_error("invalid variant in " + field.type->name);
-            for (auto& f : field.type->fields[0].type->fields)
-                fill_value(bulk, nested_bulk, t, base_name + field.name + "_", fields, values, bin, f);
-        } else if (field.type->array_of && field.type->array_of->filled_struct) {
-            fields += ", " + t.quote_name(base_name + field.name);
-            values += sep(bulk) + begin_array(bulk);
-            uint32_t n = read_varuint32(bin);
-            for (uint32_t i = 0; i < n; ++i) {
-                if (i)
-                    values += ",";
-                values += begin_object_in_array(bulk);
-                std::string struct_fields;
-                std::string struct_values;
-                for (auto& f : field.type->array_of->fields)
-                    fill_value(bulk, true, t, "", struct_fields, struct_values, bin, f);
-                if (bulk)
-                    values += struct_values.substr(1);
-                else
-                    values += struct_values.substr(2);
-                values += end_object_in_array(bulk);
-            }
-            values += end_array(bulk, t, config->schema, field.type->array_of->name);
-        } else if (field.type->array_of && field.type->array_of->filled_variant && field.type->array_of->fields[0].type->filled_struct) {
-            auto* s = field.type->array_of->fields[0].type;
-            fields += ", " + t.quote_name(base_name + field.name);
-            values += sep(bulk) + begin_array(bulk);
-            uint32_t n = read_varuint32(bin);
-            for (uint32_t i = 0; i < n; ++i) {
-                if (read_varuint32(bin) != 0)
-                    throw std::runtime_error("expected 0 variant index");
-                if (i)
-                    values += ",";
-                values += begin_object_in_array(bulk);
-                std::string struct_fields;
-                std::string struct_values;
-                for (auto& f : s->fields)
-                    fill_value(bulk, true, t, "", struct_fields, struct_values, bin, f);
-                if (bulk)
-                    values += struct_values.substr(1);
-                else
-                    values += struct_values.substr(2);
-                values += end_object_in_array(bulk);
-            }
-            values += end_array(bulk, t, config->schema, s->name);
-        } else {
-            auto abi_type    = field.type->name;
-            bool is_optional = false;
-            if (abi_type.size() >= 1 && abi_type.back() == '?') {
-                is_optional = true;
-                abi_type.resize(abi_type.size() - 1);
-            }
-            auto it = abi_type_to_sql_type.find(abi_type);
-            if (it == abi_type_to_sql_type.end())
-                throw std::runtime_error("don't know sql type for abi type: " + abi_type);
-            if (!it->second.bin_to_sql)
-                throw std::runtime_error("don't know how to process " + field.type->name);
-
-            fields += ", " + t.quote_name(base_name + field.name);
+            break;
+        }
+        case field_encoder::struct_array:
+        case field_encoder::variant_array: fill_value_array(bulk, t, values, bin, field); break;
+        case field_encoder::scalar:
+            if (!field.sql_type->bin_to_sql)
+                throw std::runtime_error("don't know how to process " + field.abi_type_name);
             if (bulk) {
                 if (nested_bulk)
                     values += ",";
                 else
                     values += "\t";
-                if (!is_optional || read_raw<bool>(bin))
-                    values += it->second.bin_to_sql(*sql_connection, bulk, bin);
+                if (!field.is_optional || read_raw<bool>(bin))
+                    values += field.sql_type->bin_to_sql(*sql_connection, bulk, bin);
                 else
                     values += "\\N";
             } else {
-                if (!is_optional || read_raw<bool>(bin))
-                    values += ", " + it->second.bin_to_sql(*sql_connection, bulk, bin);
+                values += ", ";
+                if (!field.is_optional || read_raw<bool>(bin))
+                    values += field.sql_type->bin_to_sql(*sql_connection, bulk, bin);
                 else
-                    values += ", null";
+                    values += "null";
             }
+            break;
         }
     } // fill_value
 
+    void fill_value_array(bool bulk, pqxx::work& t, std::string& values, input_buffer& bin, const field_encoder& field) {
+        values += sep(bulk);
+        values += begin_array(bulk);
+        uint32_t n = read_varuint32(bin);
+        for (uint32_t i = 0; i < n; ++i) {
+            if (field.kind == field_encoder::variant_array && read_varuint32(bin) != 0)
+                throw std::runtime_error("expected 0 variant index");
+            if (i)
+                values += ",";
+            values += begin_object_in_array(bulk);
+            // each nested field starts with a separator; the first one is dropped
+            auto pos = values.size();
+            for (auto& f : field.fields)
+                fill_value(bulk, true, t, values, bin, f);
+            values.erase(pos, std::min(values.size() - pos, size_t(bulk ? 1 : 2)));
+            values += end_object_in_array(bulk);
+        }
+        values += end_array(bulk, t, config->schema, field.element_type);
+    }
+
+    // Same layout as fill_value, but in binary copy format. When filling a composite, oids holds its field types; each field is
+    // prefixed with one.
+    void fill_binary(
+        std::vector<char>& dest, uint32_t& num_fields, const std::vector<uint32_t>* oids, input_buffer& bin, const field_encoder& field) {
+        auto begin_field = [&] {
+            if (oids)
+                push_binary<uint32_t>(dest, oids->at(num_fields));
+            ++num_fields;
+        };
+
+        switch (field.kind) {
+        case field_encoder::nested_variant:
+            if (read_varuint32(bin))
+                throw std::runtime_error("invalid variant in " + field.abi_type_name);
+            [[fallthrough]];
+        case field_encoder::nested_struct:
+            for (auto& f : field.fields)
+                fill_binary(dest, num_fields, oids, bin, f);
+            break;
+        case field_encoder::optional_struct: {
+            auto present = read_raw<bool>(bin);
+            begin_field();
+            append_binary(dest, present);
+            if (present) {
+                for (auto& f : field.fields)
+                    fill_binary(dest, num_fields, oids, bin, f);
+            } else {
+                for (auto& f : field.fields) {
+                    if (!f.sql_type || !f.sql_type->empty_to_binary)
+                        throw std::runtime_error("don't know how to process empty " + field.abi_type_name);
+                    begin_field();
+                    f.sql_type->empty_to_binary(dest);
+                }
+            }
+            break;
+        }
+        case field_encoder::struct_array:
+        case field_encoder::variant_array:
+            begin_field();
+            fill_binary_array(dest, bin, field);
+            break;
+        case field_encoder::scalar:
+            if (!field.sql_type->bin_to_binary)
+                throw std::runtime_error("don't know how to process " + field.abi_type_name);
+            begin_field();
+            if (!field.is_optional || read_raw<bool>(bin))
+                field.sql_type->bin_to_binary(dest, bin);
+            else
+                append_binary_null(dest);
+            break;
+        }
+    } // fill_binary
+
+    void fill_binary_array(std::vector<char>& dest, input_buffer& bin, const field_encoder& field) {
+        auto&    composite = get_composite_type(field.element_type);
+        uint32_t n         = read_varuint32(bin);
+        append_binary_array(dest, composite.oid, n, [&](uint32_t) {
+            if (field.kind == field_encoder::variant_array && read_varuint32(bin) != 0)
+                throw std::runtime_error("expected 0 variant index");
+            auto pos     = begin_binary_value(dest);
+            auto num_pos = dest.size();
+            push_binary<int32_t>(dest, 0);
+            uint32_t num_fields = 0;
+            for (auto& f : field.fields)
+                fill_binary(dest, num_fields, &composite.field_oids, bin, f);
+            patch_binary<int32_t>(dest, num_pos, num_fields);
+            end_binary_value(dest, pos);
+        });
+    }
+
     void
     receive_block(uint32_t block_num, const checksum256& block_id, input_buffer bin, bool bulk, pqxx::work& t, pqxx::pipeline& pipeline) {
         signed_block block;
         bin_to_native(block, bin);
 
-        std::string fields = "block_num, block_id, timestamp, producer, confirmed, previous, transaction_mroot, action_mroot, "
-                             "schedule_version, new_producers_version";
-        std::string values = sql_str(bulk, block_num) + sep(bulk) +                                 //
-                             sql_str(bulk, block_id) + sep(bulk) +                                  //
-                             sql_str(bulk, block.timestamp) + sep(bulk) +                           //
-                             sql_str(bulk, block.producer) + sep(bulk) +                            //
-                             sql_str(bulk, block.confirmed) + sep(bulk) +                           //
-                             sql_str(bulk, block.previous) + sep(bulk) +                            //
-                             sql_str(bulk, block.transaction_mroot) + sep(bulk) +                   //
-                             sql_str(bulk, block.action_mroot) + sep(bulk) +                        //
-                             sql_str(bulk, block.schedule_version) + sep(bulk) +                    //
-                             sql_str(bulk, block.new_producers ? block.new_producers->version : 0); //
+        if (use_binary(bulk)) {
+            uint32_t num_fields = 0;
+            begin_binary_row();
+            append_binary_fields(
+                num_fields, block_num, block_id, block.timestamp, block.producer, block.confirmed, block.previous, block.transaction_mroot,
+                block.action_mroot, block.schedule_version, block.new_producers ? block.new_producers->version : 0);
+            return write_binary(block_num, t, "block_info", num_fields);
+        }
+
+        begin_row();
+        append_values(
+            copy_text, block_num, block_id, block.timestamp, block.producer, block.confirmed, block.previous, block.transaction_mroot,
+            block.action_mroot, block.schedule_version, block.new_producers ? block.new_producers->version : 0);
 
         /*
         if (block.new_producers) {
@@ -689,43 +1328,98 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         }
         */
 
-        write(block_num, t, pipeline, bulk, "block_info", fields, values);
+        write(block_num, t, pipeline, bulk, "block_info");
     } // receive_block
 
     void receive_deltas(uint32_t block_num, input_buffer bin, bool bulk, pqxx::work& t, pqxx::pipeline& pipeline) {
         auto     num     = read_varuint32(bin);
         unsigned numRows = 0;
         for (uint32_t i = 0; i < num; ++i) {
-            check_variant(bin, get_type("table_delta"), "table_delta_v0");
-            table_delta_v0 table_delta;
-            bin_to_native(table_delta, bin);
+            check_variant(bin, *table_delta_type, "table_delta_v0");
+            auto               delta_begin = bin.pos;
+            table_delta_reader table_delta(bin);
 
-            if (table_delta.name == "global_property")
+            if (table_delta.name == "global_property") {
+                table_delta.skip();
                 continue;
+            }
 
-            auto& variant_type = get_type(table_delta.name);
-            if (!variant_type.filled_variant || variant_type.fields.size() != 1 || !variant_type.fields[0].type->filled_struct)
-                throw std::runtime_error("don't know how to proccess " + variant_type.name);
-            auto& type = *variant_type.fields[0].type;
+            auto table_id = delta_table_ids.find(table_delta.name);
+            if (table_id == delta_table_ids.end())
+                throw std::runtime_error("unknown table " + table_delta.name);
+            auto& table = delta_tables[table_id->second];
+            if (table.filter.include_all == false) {
+                table_delta.skip();
+                continue;
+            }
+
+            if (use_binary(bulk) && encoders) {
+                // the task holds the websocket frame, so the delta stays valid after this call without copying it
+                table_delta.skip();
+                auto&        stream = get_binary_stream(block_num, t, table_delta.name);
+                auto         frame  = connection->hold_frame();
+                input_buffer data{delta_begin, bin.pos};
+                encoders->post([this, block_num, &stream, &table, frame, data] { encode_delta(block_num, stream, table, data); });
+                numRows += table_delta.num_rows;
+                continue;
+            }
 
             size_t num_processed = 0;
-            for (auto& row : table_delta.rows) {
-                if (table_delta.rows.size() > 10000 && !(num_processed % 10000))
+            row    row;
+            while (table_delta.next(row)) {
+                if (table_delta.num_rows > 10000 && !(num_processed % 10000))
                     ilog(
                         "block ${b} ${t} ${n} of ${r} bulk=${bulk}",
-                        ("b", block_num)("t", table_delta.name)("n", num_processed)("r", table_delta.rows.size())("bulk", bulk));
-                check_variant(row.data, variant_type, 0u);
-                std::string fields = "block_num, present";
-                std::string values = std::to_string(block_num) + sep(bulk) + sql_str(bulk, row.present);
-                for (auto& field : type.fields)
-                    fill_value(bulk, false, t, "", fields, values, row.data, field);
-                write(block_num, t, pipeline, bulk, table_delta.name, fields, values);
+                        ("b", block_num)("t", table_delta.name)("n", num_processed)("r", table_delta.num_rows)("bulk", bulk));
                 ++num_processed;
+                if (!filter(table.filter, row.data))
+                    continue;
+                check_variant(row.data, *table.variant_type, 0u);
+                if (use_binary(bulk)) {
+                    uint32_t num_fields = 0;
+                    begin_binary_row();
+                    append_binary_fields(num_fields, block_num, row.present);
+                    for (auto& field : table.fields)
+                        fill_binary(binary_row, num_fields, nullptr, row.data, field);
+                    write_binary(block_num, t, table_delta.name, num_fields);
+                } else {
+                    begin_row();
+                    append_values(copy_text, block_num, row.present);
+                    for (auto& field : table.fields)
+                        fill_value(copy_text, false, t, row_values, row.data, field);
+                    write(block_num, t, pipeline, bulk, table_delta.name);
+                }
             }
-            numRows += table_delta.rows.size();
+            numRows += table_delta.num_rows;
         }
     } // receive_deltas
 
+    // Runs on an encoder thread
+    void encode_delta(uint32_t block_num, binary_table_stream& stream, const delta_table& table, input_buffer bin) {
+        table_delta_reader table_delta(bin);
+        std::vector<char>  chunk;
+        row                row;
+        while (table_delta.next(row)) {
+            if (!filter(table.filter, row.data))
+                continue;
+            check_variant(row.data, *table.variant_type, 0u);
+            auto     pos        = chunk.size();
+            uint32_t num_fields = 2;
+            push_binary<int16_t>(chunk, 0);
+            append_binary(chunk, block_num);
+            append_binary(chunk, row.present);
+            for (auto& field : table.fields)
+                fill_binary(chunk, num_fields, nullptr, row.data, field);
+            patch_binary<int16_t>(chunk, pos, num_fields);
+            if (chunk.size() >= binary_table_stream::chunk_size) {
+                stream.push(std::move(chunk));
+                chunk.clear();
+            }
+        }
+        if (!chunk.empty())
+            stream.push(std::move(chunk));
+    }
+
     void receive_traces(uint32_t block_num, input_buffer bin, bool bulk, pqxx::work& t, pqxx::pipeline& pipeline) {
         auto     num          = read_varuint32(bin);
         uint32_t num_ordinals = 0;
@@ -747,32 +1441,56 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         }
         auto        transaction_ordinal = ++num_ordinals;
         std::string failed_id           = failed ? std::string(failed->id) : "";
-        std::string fields              = "block_num, transaction_ordinal, failed_dtrx_trace";
-        std::string values =
-            std::to_string(block_num) + sep(bulk) + std::to_string(transaction_ordinal) + sep(bulk) + quote(bulk, failed_id);
-        std::string suffix_fields = ", partial_signatures, partial_context_free_data";
-        std::string suffix_values = sep(bulk) + begin_array(bulk);
+
+        if (use_binary(bulk)) {
+            auto*    partial    = ttrace.partial ? &std::get<partial_transaction_v0>(*ttrace.partial) : nullptr;
+            uint32_t num_fields = 0;
+            begin_binary_row();
+            append_binary_fields(num_fields, block_num, int32_t(transaction_ordinal), failed_id);
+            write_binary_fields(ttrace, num_fields);
+            append_binary_array(binary_row, varchar_oid, partial ? partial->signatures.size() : 0, [&](uint32_t i) {
+                append_binary(binary_row, partial->signatures[i]);
+            });
+            append_binary_array(binary_row, bytea_oid, partial ? partial->context_free_data.size() : 0, [&](uint32_t i) {
+                append_binary(binary_row, partial->context_free_data[i]);
+            });
+            num_fields += 2;
+            write_binary(block_num, t, "transaction_trace", num_fields);
+
+            for (auto& atrace : ttrace.action_traces)
+                write_action_trace(block_num, ttrace, std::get<action_trace_v0>(atrace), bulk, t, pipeline);
+            return;
+        }
+
+        begin_row();
+        append_values(copy_text, block_num, transaction_ordinal);
+        row_values += sep(copy_text);
+        row_values += quote(copy_text, failed_id);
+        write_table_fields(ttrace, copy_text);
+        row_values += sep(copy_text);
+        row_values += begin_array(copy_text);
         if (ttrace.partial) {
             auto& partial = std::get<partial_transaction_v0>(*ttrace.partial);
             for (auto& sig : partial.signatures) {
                 if (&sig != &partial.signatures[0])
-                    suffix_values += ",";
-                suffix_values += native_to_sql<abieos::signature>(*sql_connection, bulk, &sig);
+                    row_values += ",";
+                row_values += native_to_sql<abieos::signature>(*sql_connection, copy_text, &sig);
             }
         }
-        suffix_values += end_array(bulk, "varchar") + sep(bulk) + begin_array(bulk);
+        row_values += end_array(copy_text, "varchar");
+        row_values += sep(copy_text);
+        row_values += begin_array(copy_text);
         if (ttrace.partial) {
             auto& partial = std::get<partial_transaction_v0>(*ttrace.partial);
             for (auto& cfd : partial.context_free_data) {
                 if (&cfd != &partial.context_free_data[0])
-                    suffix_values += ",";
-                suffix_values += native_to_sql<abieos::input_buffer>(*sql_connection, bulk, &cfd);
+                    row_values += ",";
+                // quoted, with the leading backslash escaped once more for the array
+                row_values += "\"\\\\" + native_to_sql<abieos::input_buffer>(*sql_connection, copy_text, &cfd) + "\"";
             }
         }
-        suffix_values += end_array(bulk, "bytea");
-        write(
-            "transaction_trace", block_num, ttrace, std::move(fields), std::move(values), bulk, t, pipeline, std::move(suffix_fields),
-            std::move(suffix_values));
+        row_values += end_array(copy_text, "bytea");
+        write(block_num, t, pipeline, bulk, "transaction_trace");
 
         for (auto& atrace : ttrace.action_traces)
             write_action_trace(block_num, ttrace, std::get<action_trace_v0>(atrace), bulk, t, pipeline);
@@ -781,11 +1499,17 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
     void write_action_trace(
         uint32_t block_num, transaction_trace_v0& ttrace, action_trace_v0& atrace, bool bulk, pqxx::work& t, pqxx::pipeline& pipeline) {
 
-        std::string fields = "block_num, transaction_id, transaction_status";
-        std::string values =
-            std::to_string(block_num) + sep(bulk) + quote(bulk, (std::string)ttrace.id) + sep(bulk) + quote(bulk, to_string(ttrace.status));
-
-        write("action_trace", block_num, atrace, fields, values, bulk, t, pipeline);
+        if (use_binary(bulk)) {
+            uint32_t num_fields = 0;
+            begin_binary_row();
+            append_binary_fields(num_fields, block_num, ttrace.id, ttrace.status);
+            write_binary("action_trace", block_num, atrace, num_fields, t);
+        } else {
+            begin_row();
+            append_values(copy_text, block_num, ttrace.id, ttrace.status);
+            write_table_fields(atrace, copy_text);
+            write(block_num, t, pipeline, bulk, "action_trace");
+        }
         write_action_trace_subtable(
             "action_trace_authorization", block_num, ttrace, atrace.action_ordinal.value, atrace.act.authorization, bulk, t, pipeline);
         if (atrace.receipt)
@@ -811,79 +1535,214 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
         const std::string& name, uint32_t block_num, transaction_trace_v0& ttrace, int32_t action_ordinal, int32_t& num, T& obj, bool bulk,
         pqxx::work& t, pqxx::pipeline& pipeline) {
         ++num;
-        std::string fields = "block_num, transaction_id, action_ordinal, ordinal, transaction_status";
-        std::string values = std::to_string(block_num) + sep(bulk) + quote(bulk, (std::string)ttrace.id) + sep(bulk) +
-                             std::to_string(action_ordinal) + sep(bulk) + std::to_string(num) + sep(bulk) +
-                             quote(bulk, to_string(ttrace.status));
+        if (use_binary(bulk)) {
+            uint32_t num_fields = 0;
+            begin_binary_row();
+            append_binary_fields(num_fields, block_num, ttrace.id, action_ordinal, num, ttrace.status);
+            return write_binary(name, block_num, obj, num_fields, t);
+        }
 
-        write(name, block_num, obj, fields, values, bulk, t, pipeline);
+        begin_row();
+        append_values(copy_text, block_num, ttrace.id, action_ordinal, num, ttrace.status);
+        write_table_fields(obj, copy_text);
+        write(block_num, t, pipeline, bulk, name);
     }
 
-    void write(
-        uint32_t block_num, pqxx::work& t, pqxx::pipeline& pipeline, bool bulk, const std::string& name, const std::string& fields,
-        const std::string& values) {
-        if (bulk) {
-            write_stream(block_num, t, name, values);
-        } else {
-            std::string query =
-                "insert into " + t.quote_name(config->schema) + "." + t.quote_name(name) + "(" + fields + ") values (" + values + ")";
-            pipeline.insert(query);
+    void begin_row() { row_values.clear(); }
+
+    template <typename... T>
+    void append_values(bool bulk, const T&... values) {
+        bool first = row_values.empty();
+        auto append = [&](const auto& value) {
+            if (!first)
+                row_values += sep(bulk);
+            first = false;
+            row_values += sql_str(bulk, value);
+        };
+        (append(values), ...);
+    }
+
+    // Non-bulk rows are split into their columns and batched into one execute of the table's prepared insert per block
+    void write(uint32_t block_num, pqxx::work& t, pqxx::pipeline& pipeline, bool bulk, const std::string& name) {
+        if (bulk)
+            return write_stream(block_num, t, name, row_values);
+        auto it = table_inserts.find(name);
+        if (it == table_inserts.end())
+            throw std::runtime_error("no prepared insert for " + name);
+        auto& insert = it->second;
+        if (insert.columns.empty())
+            insert.columns.resize(insert.num_columns);
+        size_t pos = 0;
+        for (auto& column : insert.columns) {
+            if (pos > row_values.size())
+                throw std::runtime_error("row for " + name + " has too few columns");
+            auto end = std::min(row_values.find('\t', pos), row_values.size());
+            column += column.empty() ? "{" : ",";
+            append_array_element(column, std::string_view{row_values}.substr(pos, end - pos));
+            pos = end + 1;
         }
+        if (pos <= row_values.size())
+            throw std::runtime_error("row for " + name + " has too many columns");
+        insert.size += row_values.size();
+        if (insert.size >= 1024 * 1024)
+            flush_insert(t, pipeline, insert);
+    }
+
+    void flush_insert(pqxx::work& t, pqxx::pipeline& pipeline, table_insert& insert) {
+        std::string query = "execute " + insert.statement + "(";
+        for (auto& column : insert.columns) {
+            if (&column != &insert.columns[0])
+                query += ", ";
+            query += t.quote(column + "}");
+        }
+        query += ")";
+        pipeline.insert(query);
+        insert.columns.clear();
+        insert.size = 0;
+    }
+
+    void flush_inserts(pqxx::work& t, pqxx::pipeline& pipeline) {
+        for (auto& [_, insert] : table_inserts)
+            if (!insert.columns.empty())
+                flush_insert(t, pipeline, insert);
     }
 
     template <typename T>
-    void write_table_field(
-        const T& obj, std::string& fields, std::string& values, const std::string& field_name, bool bulk, pqxx::work& t,
-        pqxx::pipeline& pipeline) {
+    void write_table_field(const T& obj, bool bulk) {
         if constexpr (is_known_type(type_for<T>)) {
-            fields += ", " + t.quote_name(field_name);
-            values += sep(bulk) + type_for<T>.native_to_sql(*sql_connection, bulk, &obj);
+            row_values += sep(bulk);
+            row_values += type_for<T>.native_to_sql(*sql_connection, bulk, &obj);
         } else if constexpr (abieos::is_optional_v<T>) {
-            fields += ", "s + t.quote_name(field_name + "_present");
             bool hv = obj.has_value();
-            values += sep(bulk) + type_for<bool>.native_to_sql(*sql_connection, bulk, &hv);
-            write_table_field(obj ? *obj : typename T::value_type{}, fields, values, field_name, bulk, t, pipeline);
+            row_values += sep(bulk);
+            row_values += type_for<bool>.native_to_sql(*sql_connection, bulk, &hv);
+            write_table_field(obj ? *obj : typename T::value_type{}, bulk);
+        } else if constexpr (abieos::is_variant_v<T>) {
+            write_table_fields(std::get<0>(obj), bulk);
+        } else if constexpr (abieos::is_vector_v<T>) {
+        } else {
+            write_table_fields<T>(obj, bulk);
+        }
+    }
+
+    template <typename T>
+    void write_table_fields(const T& obj, bool bulk) {
+        for_each_field((T*)nullptr, [&](const char*, auto member_ptr) { write_table_field(member_from_void(member_ptr, &obj), bulk); });
+    }
+
+    template <typename T>
+    void write_binary_field(const T& obj, uint32_t& num_fields) {
+        if constexpr (is_known_type(type_for<T>)) {
+            type_for<T>.native_to_binary(binary_row, &obj);
+            ++num_fields;
+        } else if constexpr (abieos::is_optional_v<T>) {
+            append_binary_fields(num_fields, obj.has_value());
+            write_binary_field(obj ? *obj : typename T::value_type{}, num_fields);
         } else if constexpr (abieos::is_variant_v<T>) {
-            write_table_fields(std::get<0>(obj), fields, values, field_name + "_", bulk, t, pipeline);
+            write_binary_fields(std::get<0>(obj), num_fields);
         } else if constexpr (abieos::is_vector_v<T>) {
         } else {
-            write_table_fields<T>(obj, fields, values, field_name + "_", bulk, t, pipeline);
+            write_binary_fields<T>(obj, num_fields);
         }
     }
 
     template <typename T>
-    void write_table_fields(
-        const T& obj, std::string& fields, std::string& values, const std::string& prefix, bool bulk, pqxx::work& t,
-        pqxx::pipeline& pipeline) {
+    void write_binary_fields(const T& obj, uint32_t& num_fields) {
         for_each_field((T*)nullptr, [&](const char* field_name, auto member_ptr) {
-            write_table_field(member_from_void(member_ptr, &obj), fields, values, prefix + field_name, bulk, t, pipeline);
+            write_binary_field(member_from_void(member_ptr, &obj), num_fields);
         });
     }
 
     template <typename T>
-    void write(
-        const std::string& name, uint32_t block_num, T& obj, std::string fields, std::string values, bool bulk, pqxx::work& t,
-        pqxx::pipeline& pipeline, std::string suffix_fields = "", std::string suffix_values = "") {
+    void write_binary(const std::string& name, uint32_t block_num, const T& obj, uint32_t num_fields, pqxx::work& t) {
+        write_binary_fields(obj, num_fields);
+        write_binary(block_num, t, name, num_fields);
+    }
+
+    // Set-based: keyed tables keep only the newest row per key within the range, using one delete ... using (select distinct
+    // on ...) instead of a delete per key
+    std::string trim_query(pqxx::work& t, const trim_table& table, const std::string& prev_block, const std::string& irrev_block) {
+        auto name = t.quote_name(config->schema) + "." + t.quote_name(table.name);
+        if (table.simple)
+            return "delete from " + name + " where block_num >= " + prev_block + " and block_num < " + irrev_block;
+        if (table.keys.empty())
+            return "delete from " + name + " where block_num < (select max(block_num) from " + name + " where block_num > " +
+                   prev_block + " and block_num <= " + irrev_block + ")";
+        std::string keys, d_keys, k_keys;
+        for (auto& k : table.keys) {
+            if (&k != &table.keys.front()) {
+                keys += ", ";
+                d_keys += ", ";
+                k_keys += ", ";
+            }
+            keys += t.quote_name(k);
+            d_keys += "d." + t.quote_name(k);
+            k_keys += "k." + t.quote_name(k);
+        }
+        return "delete from " + name + " as d using (select distinct on (" + keys + ") " + keys + ", block_num from " + name +
+               " where block_num > " + prev_block + " and block_num <= " + irrev_block + " order by " + keys +
+               ", block_num desc, present desc) as k where (" + d_keys + ") = (" + k_keys + ") and d.block_num < k.block_num";
+    }
 
-        write_table_fields(obj, fields, values, "", bulk, t, pipeline);
-        fields += suffix_fields;
-        values += suffix_values;
-        write(block_num, t, pipeline, bulk, name, fields, values);
-    } // write
+    // Runs each query in its own transaction, spread over up to num_connections connections. done is called under a lock.
+    void exec_parallel(
+        const std::vector<std::string>& queries, uint32_t num_connections,
+        const std::function<void(size_t i, const pqxx::result& result)>& done) {
+        std::atomic<size_t> next{0};
+        std::mutex          mutex;
+        std::exception_ptr  error;
+        auto                run = [&] {
+            try {
+                pqxx::connection c;
+                for (size_t i; (i = next++) < queries.size();) {
+                    pqxx::work t(c);
+                    auto       result = t.exec(queries[i]);
+                    t.commit();
+                    std::lock_guard<std::mutex> lock(mutex);
+                    done(i, result);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+                next = queries.size();
+            }
+        };
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0; i < num_connections && i < queries.size(); ++i)
+            threads.emplace_back(run);
+        for (auto& thread : threads)
+            thread.join();
+        if (error)
+            std::rethrow_exception(error);
+    }
 
     void trim() {
-        if (!config->enable_trim)
+        if (!config->enable_trim || catching_up)
             return;
         auto end_trim = std::min(head, irreversible);
         if (first >= end_trim)
             return;
         create_trim();
-        pqxx::work t(*sql_connection);
         ilog("trim  ${b} - ${e}", ("b", first)("e", end_trim));
-        t.exec(
-            "select * from " + t.quote_name(config->schema) + ".trim_history(" + std::to_string(first) + ", " + std::to_string(end_trim) +
-            ")");
-        t.commit();
+        if (config->partition_size)
+            drop_trimmed_partitions(end_trim);
+
+        // Each table is trimmed in its own transaction; trimming is idempotent, so an interrupted trim is simply redone
+        std::vector<std::string> queries;
+        {
+            pqxx::work t(*sql_connection);
+            for (auto& table : trim_tables)
+                queries.push_back(trim_query(t, table, std::to_string(first), std::to_string(end_trim)));
+        }
+        size_t num_done = 0;
+        exec_parallel(queries, std::max(config->trim_threads, 1u), [&](size_t i, const pqxx::result& result) {
+            ++num_done;
+            if (result.affected_rows())
+                ilog(
+                    "trim  ${t}: ${n} rows (${d} of ${c} tables)",
+                    ("t", trim_tables[i].name)("n", result.affected_rows())("d", num_done)("c", trim_tables.size()));
+        });
         ilog("      done");
         first = end_trim;
     }
@@ -891,6 +1750,17 @@ struct fpg_session : connection_callbacks, std::enable_shared_from_this<fpg_sess
     const abi_type& get_type(const std::string& name) { return connection->get_type(name); }
 
     void closed(bool retry) override {
+        // skipped if a block failed part way; head may be ahead of what was committed. In bulk mode head also runs ahead
+        // of the open COPY streams, so those are committed first; if that fails, fill_status stays behind and restart
+        // truncates and refetches.
+        if (!in_block) {
+            try {
+                close_streams();
+                sync_fill_status();
+            } catch (const std::exception& e) {
+                elog("${e}", ("e", e.what()));
+            }
+        }
         if (my) {
             my->session.reset();
             if (retry)
@@ -922,6 +1792,20 @@ void fill_pg_plugin::set_program_options(options_description& cli, options_descr
     auto clop = cli.add_options();
     clop("fpg-drop", "Drop (delete) schema and tables");
     clop("fpg-create", "Create schema and tables");
+
+    auto op = cfg.add_options();
+    op("fpg-text-copy", "Use the text COPY format instead of binary when bulk loading");
+    op("fpg-copy-threads", bpo::value<uint32_t>()->default_value(4),
+       "Number of threads encoding rows for binary COPY. 0 encodes on the main thread. Each table streams from its own thread either way");
+    op("fpg-trim-threads", bpo::value<uint32_t>()->default_value(4), "Number of tables to trim concurrently, each on its own connection");
+    op("fpg-partition-size", bpo::value<uint32_t>()->default_value(0),
+       "Partition tables by block_num ranges of this many blocks. 0 disables partitioning. Must match the value used with --fpg-create");
+    op("fpg-catch-up",
+       "When starting from an empty database, load into UNLOGGED tables without secondary indexes until close to the chain head. "
+       "A database crash before then loses the loaded data");
+    op("fpg-sync-interval", bpo::value<uint32_t>()->default_value(0),
+       "Commit blocks with synchronous_commit=off and advance fill_status, with a synchronous commit, every [arg] blocks. 0 commits "
+       "every block synchronously");
 }
 
 void fill_pg_plugin::plugin_initialize(const variables_map& options) {
@@ -930,17 +1814,24 @@ void fill_pg_plugin::plugin_initialize(const variables_map& options) {
         if (endpoint.find(':') == std::string::npos)
             throw std::runtime_error("invalid endpoint: " + endpoint);
 
-        auto port                 = endpoint.substr(endpoint.find(':') + 1, endpoint.size());
-        auto host                 = endpoint.substr(0, endpoint.find(':'));
-        my->config->host          = host;
-        my->config->port          = port;
-        my->config->schema        = options["pg-schema"].as<std::string>();
-        my->config->skip_to       = options.count("fill-skip-to") ? options["fill-skip-to"].as<uint32_t>() : 0;
-        my->config->stop_before   = options.count("fill-stop") ? options["fill-stop"].as<uint32_t>() : 0;
-        my->config->trx_filters   = fill_plugin::get_trx_filters(options);
-        my->config->drop_schema   = options.count("fpg-drop");
-        my->config->create_schema = options.count("fpg-create");
-        my->config->enable_trim   = options.count("fill-trim");
+        auto port                  = endpoint.substr(endpoint.find(':') + 1, endpoint.size());
+        auto host                  = endpoint.substr(0, endpoint.find(':'));
+        my->config->host           = host;
+        my->config->port           = port;
+        my->config->schema         = options["pg-schema"].as<std::string>();
+        my->config->skip_to        = options.count("fill-skip-to") ? options["fill-skip-to"].as<uint32_t>() : 0;
+        my->config->stop_before    = options.count("fill-stop") ? options["fill-stop"].as<uint32_t>() : 0;
+        my->config->trx_filters    = fill_plugin::get_trx_filters(options);
+        my->config->delta_filters  = fill_plugin::get_delta_filters(options);
+        my->config->drop_schema    = options.count("fpg-drop");
+        my->config->create_schema  = options.count("fpg-create");
+        my->config->enable_trim    = options.count("fill-trim");
+        my->config->text_copy      = options.count("fpg-text-copy");
+        my->config->copy_threads   = options["fpg-copy-threads"].as<uint32_t>();
+        my->config->trim_threads   = options["fpg-trim-threads"].as<uint32_t>();
+        my->config->partition_size = options["fpg-partition-size"].as<uint32_t>();
+        my->config->catch_up       = options.count("fpg-catch-up");
+        my->config->sync_interval  = options["fpg-sync-interval"].as<uint32_t>();
     }
     FC_LOG_AND_RETHROW()
 }
@@ -22,6 +22,7 @@ void fill_plugin::set_program_options(options_description& cli, options_descript
     clop("fill-skip-to,k", bpo::value<uint32_t>(), "Skip blocks before [arg]");
     clop("fill-stop,x", bpo::value<uint32_t>(), "Stop before block [arg]");
     clop("fill-trx", bpo::value<std::vector<std::string>>(), "Filter transactions 'include:status:receiver:act_account:act_name'");
+    clop("fill-delta", bpo::value<std::vector<std::string>>(), "Filter table deltas 'include:table:code:scope:contract_table'");
 }
 
 void fill_plugin::plugin_initialize(const variables_map& options) {}
@@ -65,3 +66,41 @@ std::vector<state_history::trx_filter> fill_plugin::get_trx_filters(const variab
         throw std::runtime_error("--fill-trx: "s + e.what());
     }
 }
+
+std::vector<state_history::delta_filter> fill_plugin::get_delta_filters(const variables_map& options) {
+    try {
+        std::vector<state_history::delta_filter> result;
+        if (!options.count("fill-delta"))
+            result.push_back({true});
+        else {
+            auto v = options["fill-delta"].as<std::vector<std::string>>();
+            for (auto& s : v) {
+                boost::erase_all(s, " ");
+                std::vector<std::string> split;
+                boost::split(split, s, [](char c) { return c == ':'; });
+
+                state_history::delta_filter filt;
+                if (split.size() > 0 && split[0] == "+")
+                    filt.include = true;
+                else if (split.size() > 0 && split[0] == "-")
+                    filt.include = false;
+                else
+                    throw std::runtime_error("include must be '+' or '-'");
+
+                if (split.size() > 1)
+                    filt.table = split[1];
+                if (split.size() > 2 && !split[2].empty())
+                    filt.code = abieos::name{split[2].c_str()};
+                if (split.size() > 3 && !split[3].empty())
+                    filt.scope = abieos::name{split[3].c_str()};
+                if (split.size() > 4 && !split[4].empty())
+                    filt.contract_table = abieos::name{split[4].c_str()};
+
+                result.push_back(filt);
+            }
+        }
+        return result;
+    } catch (std::exception& e) {
+        throw std::runtime_error("--fill-delta: "s + e.what());
+    }
+}
@@ -16,5 +16,6 @@ class fill_plugin : public appbase::plugin<fill_plugin> {
     void         plugin_startup();
     void         plugin_shutdown();
 
-    static std::vector<state_history::trx_filter> get_trx_filters(const appbase::variables_map& options);
+    static std::vector<state_history::trx_filter>   get_trx_filters(const appbase::variables_map& options);
+    static std::vector<state_history::delta_filter> get_delta_filters(const appbase::variables_map& options);
 };
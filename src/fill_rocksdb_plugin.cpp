@@ -10,6 +10,7 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
 #include <fc/exception/exception.hpp>
+#include <unordered_map>
 
 using namespace abieos;
 using namespace appbase;
@@ -44,14 +45,19 @@ struct rocksdb_table {
     const abieos::abi_type*                     abi_type  = {};
     std::vector<std::unique_ptr<rocksdb_field>> fields    = {};
     std::map<std::string, rocksdb_field*>       field_map = {};
+    state_history::table_filter                 filter    = {};
 };
 
 struct fill_rocksdb_config : connection_config {
-    uint32_t                skip_to      = 0;
-    uint32_t                stop_before  = 0;
-    std::vector<trx_filter> trx_filters  = {};
-    bool                    enable_trim  = false;
-    bool                    enable_check = false;
+    uint32_t                  skip_to       = 0;
+    uint32_t                  stop_before   = 0;
+    std::vector<trx_filter>   trx_filters   = {};
+    std::vector<delta_filter> delta_filters = {};
+    bool                      enable_trim   = false;
+    bool                      enable_check  = false;
+    bool                      overlay       = false;
+    bool                      wal           = false;
+    uint32_t                  wal_sync      = 1;
 };
 
 struct fill_rocksdb_plugin_impl : std::enable_shared_from_this<fill_rocksdb_plugin_impl> {
@@ -76,21 +82,27 @@ struct fill_rocksdb_plugin_impl : std::enable_shared_from_this<fill_rocksdb_plug
 };
 
 struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_session> {
-    fill_rocksdb_plugin_impl*                  my = nullptr;
-    std::shared_ptr<fill_rocksdb_config>       config;
-    std::shared_ptr<::rocksdb_inst>            rocksdb_inst = app().find_plugin<rocksdb_plugin>()->get_rocksdb_inst(false);
-    rocksdb::WriteBatch                        active_content_batch;
-    rocksdb::WriteBatch                        active_index_batch;
-    std::shared_ptr<state_history::connection> connection;
-    std::map<std::string, rocksdb_table>       tables             = {};
-    rocksdb_table*                             block_info_table   = {};
-    rocksdb_table*                             action_trace_table = {};
-    std::optional<state_history::fill_status>  current_db_status  = {};
-    uint32_t                                   head               = 0;
-    abieos::checksum256                        head_id            = {};
-    uint32_t                                   irreversible       = 0;
-    abieos::checksum256                        irreversible_id    = {};
-    uint32_t                                   first              = 0;
+    fill_rocksdb_plugin_impl*                      my = nullptr;
+    std::shared_ptr<fill_rocksdb_config>           config;
+    std::shared_ptr<::rocksdb_inst>                rocksdb_inst = app().find_plugin<rocksdb_plugin>()->get_rocksdb_inst(false);
+    rocksdb::WriteBatch                            active_content_batch;
+    rocksdb::WriteBatch                            active_index_batch;
+    std::shared_ptr<state_history::connection>     connection;
+    std::unordered_map<std::string, rocksdb_table> tables             = {};
+    const abieos::abi_type*                        table_delta_type   = {};
+    rocksdb_table*                                 block_info_table   = {};
+    rocksdb_table*                                 action_trace_table = {};
+    std::optional<state_history::fill_status>      current_db_status  = {};
+    uint32_t                                       head               = 0;
+    abieos::checksum256                            head_id            = {};
+    uint32_t                                       irreversible       = 0;
+    abieos::checksum256                            irreversible_id    = {};
+    uint32_t                                       first              = 0;
+    uint32_t                                       flushed_head       = 0; // last block in the database; later ones are in the overlay
+    abieos::checksum256                            flushed_head_id    = {};
+    bool                                           writing_reversible = false;
+    bool                                           started            = false;
+    uint32_t                                       num_unsynced       = 0;
 
     flm_session(fill_rocksdb_plugin_impl* my)
         : my(my)
@@ -265,6 +277,7 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         table.name     = table_name;
         table.kv_table = &get_kv_table(table_name);
         table.abi_type = &get_type(table_type);
+        table.filter   = get_table_filter(config->delta_filters, table_name);
 
         if (!table.abi_type->filled_variant || table.abi_type->fields.size() != 1 || !table.abi_type->fields[0].type->filled_struct)
             throw std::runtime_error("don't know how to process " + table.abi_type->name);
@@ -278,6 +291,7 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         jvalue      j;
         if (!json_to_jvalue(j, error, abi_json))
             throw std::runtime_error(error);
+        table_delta_type = &get_type("table_delta");
         for (auto& t : std::get<jarray>(std::get<jobject>(j.value)["tables"].value)) {
             auto& o = std::get<jobject>(t.value);
             add_table(
@@ -328,13 +342,26 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
 
     void received_abi(std::string_view abi) override {
         init_tables(abi);
+        rocksdb_inst->overlay.clear();
 
         load_fill_status();
-        ilog("clean up stale records");
-        end_write(true);
-        truncate(head + 1);
-        end_write(true);
-        rocksdb_inst->database.flush(true, true);
+        auto clean = rdb::get<kv::received_block>(rocksdb_inst->database, kv::make_clean_shutdown_key(), false);
+        if (clean && clean->block_num == head && clean->block_id == head_id) {
+            ilog("clean shutdown at block ${b}; skip clean up", ("b", head));
+        } else {
+            ilog("clean up stale records");
+            end_write(true);
+            truncate(head + 1);
+            end_write(true);
+            rocksdb_inst->database.flush(true, true);
+        }
+        if (clean) {
+            // anything written from here on invalidates it
+            rocksdb::WriteBatch batch;
+            batch.Delete(rdb::to_slice(kv::make_clean_shutdown_key()));
+            write(rocksdb_inst->database, batch);
+        }
+        started = true;
 
         if (config->enable_check)
             check();
@@ -358,6 +385,8 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         irreversible    = current_db_status->irreversible;
         irreversible_id = current_db_status->irreversible_id;
         first           = current_db_status->first;
+        flushed_head    = head;
+        flushed_head_id = head_id;
     }
 
     std::vector<block_position> get_positions() {
@@ -378,7 +407,23 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         else
             current_db_status = state_history::fill_status{
                 .head = head, .head_id = head_id, .irreversible = head, .irreversible_id = head_id, .first = first};
-        rdb::put(batch, kv::make_fill_status_key(), *current_db_status, true);
+
+        // with the overlay, queries see its status. The database's status only covers what has been flushed, which is
+        // irreversible.
+        if (config->overlay)
+            rocksdb_inst->overlay.put(kv::make_fill_status_key(), abieos::native_to_bin(*current_db_status));
+        if (!config->overlay || flushed_head == head)
+            rdb::put(batch, kv::make_fill_status_key(), *current_db_status, true);
+        else
+            rdb::put(
+                batch, kv::make_fill_status_key(),
+                state_history::fill_status{
+                    .head            = flushed_head,
+                    .head_id         = flushed_head_id,
+                    .irreversible    = flushed_head,
+                    .irreversible_id = flushed_head_id,
+                    .first           = first},
+                true);
     }
 
     void truncate(uint32_t block) {
@@ -410,6 +455,40 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         ilog("removed ${r} rows and ${i} index entries", ("r", num_rows)("i", num_indexes));
     }
 
+    // Forks above flushed_head only need to drop blocks from the overlay
+    void truncate_overlay(uint32_t block) {
+        rocksdb_inst->overlay.truncate(block);
+        head = block - 1;
+        if (head == flushed_head) {
+            head_id = flushed_head_id;
+        } else {
+            auto rb = rocksdb_inst->overlay.get(kv::make_received_block_key(head));
+            if (!rb)
+                throw std::runtime_error("overlay is missing block " + std::to_string(head));
+            abieos::input_buffer bin{rb->data(), rb->data() + rb->size()};
+            head_id = abieos::bin_to_native<kv::received_block>(bin).block_id;
+        }
+        first = std::min(first, head);
+    }
+
+    void flush_overlay(uint32_t block, const abieos::checksum256& block_id) {
+        rocksdb_inst->overlay.flush(rocksdb_inst->database, block);
+        flushed_head    = block;
+        flushed_head_id = block_id;
+    }
+
+    // Lets the next start skip truncate(), which otherwise scans everything above head
+    void mark_clean_shutdown() {
+        if (!started)
+            return;
+        end_write(true);
+        rdb::put(active_index_batch, kv::make_clean_shutdown_key(), kv::received_block{flushed_head, flushed_head_id});
+        end_write(false);
+        rocksdb_inst->database.flush(true, true);
+        started = false;
+        ilog("clean shutdown at block ${b}", ("b", flushed_head));
+    }
+
     void end_write(bool write_fill) {
         if (write_fill)
             write_fill_status(active_index_batch);
@@ -424,8 +503,9 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
             return true;
         if (config->stop_before && result.this_block->block_num >= config->stop_before) {
             ilog("block ${b}: stop requested", ("b", result.this_block->block_num));
-            end_write(true);
-            rocksdb_inst->database.flush(false, false);
+            if (config->overlay)
+                flush_overlay(head, head_id);
+            mark_clean_shutdown();
             return false;
         }
 
@@ -451,17 +531,40 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
             if (result.this_block->block_num <= head) {
                 ilog("switch forks at block ${b}", ("b", result.this_block->block_num));
                 end_write(true);
-                truncate(result.this_block->block_num);
+                if (config->overlay && result.this_block->block_num > flushed_head)
+                    truncate_overlay(result.this_block->block_num);
+                else
+                    truncate(result.this_block->block_num);
                 end_write(true);
             }
 
             bool near       = result.this_block->block_num + 4 >= result.last_irreversible.block_num;
             bool commit_now = !(result.this_block->block_num % 200) || near;
+
+            // With --frdb-wal, writes near head go through the WAL instead of a memtable flush per block. Flush once when
+            // switching so the earlier writes, which skipped the WAL, are on disk before any that follow them.
+            auto& database = rocksdb_inst->database;
+            if (config->wal && near != database.wal) {
+                if (near)
+                    database.flush(true, true);
+                database.wal = near;
+                num_unsynced = 0;
+            }
             if (commit_now)
                 ilog("block ${b}", ("b", result.this_block->block_num));
 
             if (head_id != abieos::checksum256{} && (!result.prev_block || result.prev_block->block_id != head_id))
                 throw std::runtime_error("prev_block does not match");
+
+            // reversible blocks go to the overlay as a unit; anything still pending belongs in the database
+            writing_reversible = config->overlay && result.this_block->block_num > result.last_irreversible.block_num;
+            if (writing_reversible && (active_content_batch.Count() || active_index_batch.Count()))
+                end_write(false);
+
+            // LIB can jump past blocks still in the overlay (e.g. a producer schedule change). flushed_head is about to move to
+            // this block, so everything below it must reach the database first.
+            if (config->overlay && !writing_reversible && head > flushed_head)
+                flush_overlay(head, head_id);
             if (result.block)
                 receive_block(
                     result.this_block->block_num, result.this_block->block_id, *result.block, active_content_batch, active_index_batch);
@@ -481,13 +584,30 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
                 active_content_batch, kv::make_received_block_key(result.this_block->block_num),
                 kv::received_block{result.this_block->block_num, result.this_block->block_id});
 
+            if (writing_reversible) {
+                rocksdb_inst->overlay.add_block(head, active_content_batch, active_index_batch);
+                writing_reversible = false;
+            } else {
+                flushed_head    = head;
+                flushed_head_id = head_id;
+            }
+            bool flush_now = config->overlay && irreversible >= flushed_head + 200;
+            if (flush_now)
+                flush_overlay(irreversible, irreversible_id);
+
             if (commit_now) {
                 end_write(true);
                 if (config->enable_trim)
                     trim();
             }
-            if (near)
-                rocksdb_inst->database.flush(false, false);
+            if (database.wal) {
+                if (++num_unsynced >= config->wal_sync) {
+                    database.sync_wal();
+                    num_unsynced = 0;
+                }
+            } else if (config->overlay ? flush_now : near) {
+                database.flush(false, false);
+            }
         } catch (...) {
             throw;
         }
@@ -542,12 +662,16 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         rdb::put(content_batch, key, value);
 
         std::vector<char> index_key;
+        std::vector<char> index_value;
         for (auto* index : table.kv_table->indexes) {
             index_key.clear();
             kv::append_index_key(index_key, table.kv_table->short_name, index->short_name);
             kv::extract_keys(index_key, {value.data(), value.data() + value.size()}, index->sort_keys, positions);
             kv::append_index_suffix(index_key, block_num, present_k);
-            index_batch.Put(rdb::to_slice(index_key), {});
+            index_value.clear();
+            if (!index->covered_fields.empty())
+                kv::append_covered_fields(index_value, {value.data(), value.data() + value.size()}, *index, positions);
+            index_batch.Put(rdb::to_slice(index_key), rdb::to_slice(index_value));
         }
     }
 
@@ -612,28 +736,35 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         abieos::native_to_bin(block.schedule_version, value);
         abieos::native_to_bin(block.new_producers ? *block.new_producers : state_history::producer_schedule{}, value);
 
-        add_row(content_batch, index_batch, get_table("block_info"), block_num, true, value);
+        add_row(content_batch, index_batch, *block_info_table, block_num, true, value);
     } // receive_block
 
     void receive_deltas(rocksdb::WriteBatch& content_batch, rocksdb::WriteBatch& index_batch, uint32_t block_num, input_buffer bin) {
-        auto&             table_delta_type = get_type("table_delta");
         std::vector<char> value;
 
         auto num = read_varuint32(bin);
         for (uint32_t i = 0; i < num; ++i) {
-            check_variant(bin, table_delta_type, "table_delta_v0");
-            state_history::table_delta_v0 table_delta;
-            bin_to_native(table_delta, bin);
-            auto& table = get_table(table_delta.name);
-
-            size_t num_processed = 0;
-            for (auto& row : table_delta.rows) {
-                if (table_delta.rows.size() > 10000 && !(num_processed % 10000)) {
+            check_variant(bin, *table_delta_type, "table_delta_v0");
+            state_history::table_delta_reader table_delta(bin);
+            auto&                             table = get_table(table_delta.name);
+            if (table.filter.include_all == false) {
+                table_delta.skip();
+                continue;
+            }
+
+            size_t             num_processed = 0;
+            state_history::row row;
+            while (table_delta.next(row)) {
+                if (table_delta.num_rows > 10000 && !(num_processed % 10000)) {
                     ilog(
                         "block ${b} ${t} ${n} of ${r}",
-                        ("b", block_num)("t", table_delta.name)("n", num_processed)("r", table_delta.rows.size()));
-                    end_write(false);
+                        ("b", block_num)("t", table_delta.name)("n", num_processed)("r", table_delta.num_rows));
+                    if (!writing_reversible)
+                        end_write(false);
                 }
+                ++num_processed;
+                if (!filter(table.filter, row.data))
+                    continue;
                 check_variant(row.data, *table.abi_type, 0u);
                 value.clear();
                 abieos::native_to_bin(block_num, value);
@@ -641,7 +772,6 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
                 for (auto& field : table.fields)
                     fill(value, row.data, *field);
                 add_row(content_batch, index_batch, table, block_num, row.present, value);
-                ++num_processed;
             }
         }
     } // receive_deltas
@@ -732,7 +862,7 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
         abieos::native_to_bin(atrace.console, value);
         abieos::native_to_bin(atrace.except ? *atrace.except : std::string(), value);
 
-        add_row(content_batch, index_batch, get_table("action_trace"), block_num, true, value);
+        add_row(content_batch, index_batch, *action_trace_table, block_num, true, value);
 
         // todo: receipt_auth_sequence
         // todo: authorization
@@ -741,6 +871,8 @@ struct flm_session : connection_callbacks, std::enable_shared_from_this<flm_sess
 
     void trim() {
         auto end_trim = std::min(head, irreversible);
+        if (config->overlay)
+            end_trim = std::min(end_trim, flushed_head);
         if (first >= end_trim)
             return;
         rocksdb_inst->database.flush(true, true);
@@ -840,7 +972,13 @@ fill_rocksdb_plugin::fill_rocksdb_plugin()
 fill_rocksdb_plugin::~fill_rocksdb_plugin() {}
 
 void fill_rocksdb_plugin::set_program_options(options_description& cli, options_description& cfg) {
+    auto op   = cfg.add_options();
     auto clop = cli.add_options();
+    op("frdb-overlay",
+       "Keep blocks above LIB in memory instead of writing them to the database and removing them on forks. They're written in "
+       "batches once irreversible. Queries in the same process (combo-rocksdb) see them");
+    op("frdb-wal", "Near the head, write through the RocksDB WAL instead of flushing memtables every block");
+    op("frdb-wal-sync", bpo::value<uint32_t>()->default_value(1), "With --frdb-wal, sync the WAL to disk every [arg] blocks");
     clop("frdb-check", "Check database");
 }
 
@@ -850,15 +988,19 @@ void fill_rocksdb_plugin::plugin_initialize(const variables_map& options) {
         if (endpoint.find(':') == std::string::npos)
             throw std::runtime_error("invalid endpoint: " + endpoint);
 
-        auto port                = endpoint.substr(endpoint.find(':') + 1, endpoint.size());
-        auto host                = endpoint.substr(0, endpoint.find(':'));
-        my->config->host         = host;
-        my->config->port         = port;
-        my->config->skip_to      = options.count("fill-skip-to") ? options["fill-skip-to"].as<uint32_t>() : 0;
-        my->config->stop_before  = options.count("fill-stop") ? options["fill-stop"].as<uint32_t>() : 0;
-        my->config->trx_filters  = fill_plugin::get_trx_filters(options);
-        my->config->enable_trim  = options.count("fill-trim");
-        my->config->enable_check = options.count("frdb-check");
+        auto port                 = endpoint.substr(endpoint.find(':') + 1, endpoint.size());
+        auto host                 = endpoint.substr(0, endpoint.find(':'));
+        my->config->host          = host;
+        my->config->port          = port;
+        my->config->skip_to       = options.count("fill-skip-to") ? options["fill-skip-to"].as<uint32_t>() : 0;
+        my->config->stop_before   = options.count("fill-stop") ? options["fill-stop"].as<uint32_t>() : 0;
+        my->config->trx_filters   = fill_plugin::get_trx_filters(options);
+        my->config->delta_filters = fill_plugin::get_delta_filters(options);
+        my->config->enable_trim   = options.count("fill-trim");
+        my->config->enable_check  = options.count("frdb-check");
+        my->config->overlay       = options.count("frdb-overlay");
+        my->config->wal           = options.count("frdb-wal");
+        my->config->wal_sync      = std::max(options["frdb-wal-sync"].as<uint32_t>(), 1u);
     }
     FC_LOG_AND_RETHROW()
 }
@@ -866,8 +1008,14 @@ void fill_rocksdb_plugin::plugin_initialize(const variables_map& options) {
 void fill_rocksdb_plugin::plugin_startup() { my->start(); }
 
 void fill_rocksdb_plugin::plugin_shutdown() {
-    if (my->session)
+    if (my->session) {
+        try {
+            my->session->mark_clean_shutdown();
+        } catch (const std::exception& e) {
+            elog("${e}", ("e", e.what()));
+        }
         my->session->connection->close(false);
+    }
     my->timer.cancel();
     ilog("fill_rocksdb_plugin stopped");
 }
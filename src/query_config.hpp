@@ -42,6 +42,61 @@ constexpr void for_each_field(key<Defs>*, F f) {
     ABIEOS_MEMBER(key<Defs>, arg_expression);
 };
 
+enum class condition_op {
+    eq,
+    ne,
+    lt,
+    le,
+    gt,
+    ge,
+};
+
+inline condition_op get_condition_op(const std::string& op) {
+    if (op == "=")
+        return condition_op::eq;
+    if (op == "!=")
+        return condition_op::ne;
+    if (op == "<")
+        return condition_op::lt;
+    if (op == "<=")
+        return condition_op::le;
+    if (op == ">")
+        return condition_op::gt;
+    if (op == ">=")
+        return condition_op::ge;
+    throw std::runtime_error("unknown condition op: " + op);
+}
+
+// Whether a condition holds, given the sign of comparing the row's value against the condition's value
+inline bool test_condition(condition_op op, int cmp) {
+    switch (op) {
+    case condition_op::eq: return cmp == 0;
+    case condition_op::ne: return cmp != 0;
+    case condition_op::lt: return cmp < 0;
+    case condition_op::le: return cmp <= 0;
+    case condition_op::gt: return cmp > 0;
+    case condition_op::ge: return cmp >= 0;
+    }
+    return false;
+}
+
+// A predicate on one field of a query's rows. Rows which fail it are dropped before they count against max_results.
+template <typename Defs>
+struct condition {
+    std::string                 name    = {};
+    std::string                 op      = {};
+    std::string                 value   = {};
+    condition_op                op_code = {};
+    const typename Defs::field* field   = {};
+};
+
+template <typename Defs, typename F>
+constexpr void for_each_field(condition<Defs>*, F f) {
+    ABIEOS_MEMBER(condition<Defs>, name);
+    ABIEOS_MEMBER(condition<Defs>, op);
+    ABIEOS_MEMBER(condition<Defs>, value);
+};
+
 template <typename Defs>
 struct table {
     std::string                                        name           = {};
@@ -68,14 +123,17 @@ constexpr void for_each_field(table<Defs>*, F f) {
 
 template <typename Defs>
 struct index {
-    abieos::name                     short_name    = {};
-    std::string                      index         = {};
-    std::string                      table         = {};
-    bool                             include_in_pg = {};
-    bool                             only_for_trim = {};
-    std::vector<typename Defs::key>  sort_keys     = {};
-    std::vector<typename Defs::type> range_types   = {};
-    const typename Defs::table*      table_obj     = {};
+    abieos::name                             short_name      = {};
+    std::string                              index           = {};
+    std::string                              table           = {};
+    bool                                     include_in_pg   = {};
+    bool                                     only_for_trim   = {};
+    std::vector<typename Defs::key>          sort_keys       = {};
+    std::vector<std::string>                 covering_fields = {};
+    std::vector<typename Defs::type>         range_types     = {};
+    std::vector<const typename Defs::field*> covered_fields  = {}; // covering_fields, in table order
+    bool                                     covers_row      = {}; // every field is covered
+    const typename Defs::table*              table_obj       = {};
 };
 
 template <typename Defs, typename F>
@@ -86,26 +144,28 @@ constexpr void for_each_field(index<Defs>*, F f) {
     ABIEOS_MEMBER(index<Defs>, include_in_pg);
     ABIEOS_MEMBER(index<Defs>, only_for_trim);
     ABIEOS_MEMBER(index<Defs>, sort_keys);
+    ABIEOS_MEMBER(index<Defs>, covering_fields);
 };
 
 template <typename Defs>
 struct query {
-    abieos::name                      short_name            = {};
-    std::string                       index                 = {};
-    std::string                       function              = {};
-    std::string                       table                 = {};
-    bool                              has_block_snapshot    = {};
-    uint32_t                          max_results           = {};
-    std::string                       join                  = {};
-    abieos::name                      join_query_short_name = {};
-    std::vector<typename Defs::key>   join_key_values       = {};
-    std::vector<typename Defs::key>   fields_from_join      = {};
-    std::vector<typename Defs::type>  arg_types             = {};
-    std::vector<typename Defs::field> result_fields         = {};
-    const typename Defs::index*       index_obj             = {};
-    const typename Defs::table*       table_obj             = {};
-    const typename Defs::table*       join_table            = {};
-    const query*                      join_query            = {};
+    abieos::name                          short_name            = {};
+    std::string                           index                 = {};
+    std::string                           function              = {};
+    std::string                           table                 = {};
+    bool                                  has_block_snapshot    = {};
+    uint32_t                              max_results           = {};
+    std::string                           join                  = {};
+    abieos::name                          join_query_short_name = {};
+    std::vector<typename Defs::key>       join_key_values       = {};
+    std::vector<typename Defs::key>       fields_from_join      = {};
+    std::vector<typename Defs::condition> conditions            = {};
+    std::vector<typename Defs::type>      arg_types             = {};
+    std::vector<typename Defs::field>     result_fields         = {};
+    const typename Defs::index*           index_obj             = {};
+    const typename Defs::table*           table_obj             = {};
+    const typename Defs::table*           join_table            = {};
+    const query*                          join_query            = {};
 };
 
 template <typename Defs, typename F>
@@ -120,6 +180,7 @@ constexpr void for_each_field(query<Defs>*, F f) {
     ABIEOS_MEMBER(query<Defs>, join_query_short_name);
     ABIEOS_MEMBER(query<Defs>, join_key_values);
     ABIEOS_MEMBER(query<Defs>, fields_from_join);
+    ABIEOS_MEMBER(query<Defs>, conditions);
 };
 
 template <typename Defs, typename Key>
@@ -200,6 +261,17 @@ struct config {
             table.index_map[index.index] = &index;
             set_key_fields(*index.table_obj, index.sort_keys);
             add_types(index.range_types, index.sort_keys, index.table_obj, index.short_name);
+
+            std::map<std::string, bool> covered;
+            for (auto& name : index.covering_fields) {
+                if (table.field_map.find(name) == table.field_map.end())
+                    throw std::runtime_error("index " + (std::string)index.short_name + ": unknown covering field: " + name);
+                covered[name] = true;
+            }
+            for (auto& field : table.fields)
+                if (covered[field.name])
+                    index.covered_fields.push_back(&field);
+            index.covers_row = !index.covered_fields.empty() && index.covered_fields.size() == table.fields.size();
         }
 
         for (auto& query : queries) {
@@ -217,6 +289,14 @@ struct config {
                 throw std::runtime_error(
                     "query '" + (std::string)query.short_name + "': index: '" + query.index + "' is marked only_for_trim");
             set_join_key_fields(*query.table_obj, query.join_key_values);
+            set_key_fields(*query.table_obj, query.conditions);
+            for (auto& cond : query.conditions) {
+                cond.op_code = get_condition_op(cond.op);
+                // RocksDB orders names by their uint64 value, PostgreSQL as text; only equality means the same in both
+                if (cond.field->type == "name" && cond.op_code != condition_op::eq && cond.op_code != condition_op::ne)
+                    throw std::runtime_error(
+                        "query " + (std::string)query.short_name + ": condition on name field " + cond.name + " only supports = and !=");
+            }
 
             query.result_fields = query.table_obj->fields;
             if (!query.join.empty()) {
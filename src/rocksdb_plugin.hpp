@@ -9,6 +9,7 @@
 struct rocksdb_inst {
     state_history::rdb::database                     database;
     std::unique_ptr<const state_history::kv::config> query_config{};
+    state_history::rdb::overlay                      overlay; // reversible blocks, when fill-rocksdb runs with --frdb-overlay
 
     rocksdb_inst(const char* db_path, std::optional<uint32_t> threads, std::optional<uint32_t> max_open_files, bool fast_reads)
         : database{db_path, threads, max_open_files, fast_reads} {}
@@ -186,6 +186,36 @@ ABIEOS_REFLECT(table_delta_v0) {
     ABIEOS_MEMBER(table_delta_v0, rows)
 }
 
+// Reads a table_delta_v0 one row at a time instead of materializing its rows. Rows point into bin, which advances past the
+// delta once every row has been read or skipped.
+struct table_delta_reader {
+    abieos::input_buffer& bin;
+    std::string           name      = {};
+    uint32_t              num_rows  = {};
+    uint32_t              remaining = {};
+
+    explicit table_delta_reader(abieos::input_buffer& bin)
+        : bin(bin) {
+        abieos::bin_to_native(name, bin);
+        num_rows  = abieos::read_varuint32(bin);
+        remaining = num_rows;
+    }
+
+    bool next(row& r) {
+        if (!remaining)
+            return false;
+        --remaining;
+        abieos::bin_to_native(r, bin);
+        return true;
+    }
+
+    void skip() {
+        row r;
+        while (next(r)) {
+        }
+    }
+};
+
 struct permission_level {
     abieos::name actor      = {};
     abieos::name permission = {};
@@ -520,4 +550,67 @@ inline bool filter(const std::vector<trx_filter>& filters, const transaction_tra
     return false;
 }
 
+struct delta_filter {
+    bool                        include        = {};
+    std::string                 table          = {}; // empty matches all; a trailing '*' matches a prefix
+    std::optional<abieos::name> code           = {}; // code, scope, and contract_table only match contract tables' rows
+    std::optional<abieos::name> scope          = {};
+    std::optional<abieos::name> contract_table = {};
+};
+
+inline bool is_contract_table(const std::string& table) { return !table.compare(0, 9, "contract_"); }
+
+inline bool has_row_conditions(const delta_filter& filter) { return filter.code || filter.scope || filter.contract_table; }
+
+inline bool matches(const delta_filter& filter, const std::string& table) {
+    if (filter.table.empty())
+        return true;
+    if (filter.table.back() == '*')
+        return !table.compare(0, filter.table.size() - 1, filter.table, 0, filter.table.size() - 1);
+    return filter.table == table;
+}
+
+// The delta filters which apply to one table, worked out once so rows of tables which are wholly included or excluded don't
+// need to be examined
+struct table_filter {
+    std::optional<bool>       include_all = {};
+    std::vector<delta_filter> row_filters = {};
+};
+
+inline table_filter get_table_filter(const std::vector<delta_filter>& filters, const std::string& table) {
+    table_filter result;
+    bool         contract = is_contract_table(table);
+    for (auto& filt : filters) {
+        if (!matches(filt, table) || (has_row_conditions(filt) && !contract))
+            continue;
+        if (!has_row_conditions(filt) && result.row_filters.empty()) {
+            result.include_all = filt.include;
+            return result;
+        }
+        result.row_filters.push_back(filt);
+        if (!has_row_conditions(filt))
+            return result;
+    }
+    if (result.row_filters.empty())
+        result.include_all = false;
+    return result;
+}
+
+// data is a row of a table delta, starting at its variant index. Contract tables' rows start with code, scope, and table.
+inline bool filter(const table_filter& filters, abieos::input_buffer data) {
+    if (filters.include_all)
+        return *filters.include_all;
+    abieos::read_varuint32(data);
+    auto code  = abieos::bin_to_native<abieos::name>(data);
+    auto scope = abieos::bin_to_native<abieos::name>(data);
+    auto table = abieos::bin_to_native<abieos::name>(data);
+    for (auto& filt : filters.row_filters) {
+        if ((filt.code && *filt.code != code) || (filt.scope && *filt.scope != scope) ||
+            (filt.contract_table && *filt.contract_table != table))
+            continue;
+        return filt.include;
+    }
+    return false;
+}
+
 } // namespace state_history
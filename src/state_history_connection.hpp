@@ -9,9 +9,89 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
 #include <fc/exception/exception.hpp>
+#include <mutex>
+#include <sys/mman.h>
 
 namespace state_history {
 
+// Allocates large blocks with mmap and asks for transparent huge pages, so multi-GB frames don't pay a page fault per 4k page
+template <typename T>
+struct frame_allocator {
+    using value_type = T;
+
+    static constexpr size_t huge_threshold = 2 * 1024 * 1024;
+
+    frame_allocator() = default;
+    template <typename U>
+    frame_allocator(const frame_allocator<U>&) {}
+
+    T* allocate(size_t n) {
+        auto size = n * sizeof(T);
+        if (size < huge_threshold)
+            return std::allocator<T>{}.allocate(n);
+        auto* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc{};
+#ifdef MADV_HUGEPAGE
+        madvise(p, size, MADV_HUGEPAGE);
+#endif
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t n) {
+        auto size = n * sizeof(T);
+        if (size < huge_threshold)
+            return std::allocator<T>{}.deallocate(p, n);
+        munmap(p, size);
+    }
+
+    template <typename U>
+    bool operator==(const frame_allocator<U>&) const {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const frame_allocator<U>&) const {
+        return false;
+    }
+};
+
+using frame_buffer = boost::beast::basic_flat_buffer<frame_allocator<char>>;
+
+// Keeps a few read buffers around, with their capacity, instead of allocating and freeing one per message. A buffer goes
+// back to the pool when its last shared_ptr is released, which may happen on another thread.
+struct frame_pool : std::enable_shared_from_this<frame_pool> {
+    size_t                                     max_free = 4;
+    std::mutex                                 mutex;
+    std::vector<std::unique_ptr<frame_buffer>> free_buffers;
+
+    std::shared_ptr<frame_buffer> get() {
+        std::unique_ptr<frame_buffer> buffer;
+        {
+            std::lock_guard lock{mutex};
+            if (!free_buffers.empty()) {
+                buffer = std::move(free_buffers.back());
+                free_buffers.pop_back();
+            }
+        }
+        if (!buffer)
+            buffer = std::make_unique<frame_buffer>();
+        return {buffer.release(), [pool = weak_from_this()](frame_buffer* buffer) {
+                    if (auto p = pool.lock())
+                        p->put(buffer);
+                    else
+                        delete buffer;
+                }};
+    }
+
+    void put(frame_buffer* buffer) {
+        std::unique_ptr<frame_buffer> p{buffer};
+        p->consume(p->size());
+        std::lock_guard lock{mutex};
+        if (free_buffers.size() < max_free)
+            free_buffers.push_back(std::move(p));
+    }
+}; // frame_pool
+
 struct connection_callbacks {
     virtual ~connection_callbacks() = default;
     virtual void received_abi(std::string_view abi) {}
@@ -27,7 +107,7 @@ struct connection_config {
 
 struct connection : std::enable_shared_from_this<connection> {
     using error_code  = boost::system::error_code;
-    using flat_buffer = boost::beast::flat_buffer;
+    using flat_buffer = frame_buffer;
     using tcp         = boost::asio::ip::tcp;
 
     using abi_def      = abieos::abi_def;
@@ -44,6 +124,8 @@ struct connection : std::enable_shared_from_this<connection> {
     bool                                         have_abi  = false;
     abi_def                                      abi       = {};
     std::map<std::string, abi_type>              abi_types = {};
+    std::shared_ptr<frame_pool>                  frames    = std::make_shared<frame_pool>();
+    std::shared_ptr<flat_buffer>                 frame     = {};
 
     connection(boost::asio::io_context& ioc, const connection_config& config, std::shared_ptr<connection_callbacks> callbacks)
         : config(config)
@@ -75,17 +157,20 @@ struct connection : std::enable_shared_from_this<connection> {
     }
 
     void start_read() {
-        auto in_buffer = std::make_shared<flat_buffer>();
+        auto in_buffer = frames->get();
         stream.async_read(*in_buffer, [self = shared_from_this(), this, in_buffer](error_code ec, size_t) {
             enter_callback(ec, "async_read", [&] {
+                frame = in_buffer;
                 if (!have_abi)
                     receive_abi(in_buffer);
                 else {
                     if (!receive_result(in_buffer)) {
+                        frame.reset();
                         close(false);
                         return;
                     }
                 }
+                frame.reset();
                 start_read();
             });
         });
@@ -110,6 +195,14 @@ struct connection : std::enable_shared_from_this<connection> {
         return callbacks && std::visit([&](auto& r) { return callbacks->received(r); }, result);
     }
 
+    // Callbacks may call this from inside received() to keep the current message, and the input_buffers pointing into it,
+    // alive after returning. The next read goes into another buffer; this one returns to the pool once released.
+    std::shared_ptr<const flat_buffer> hold_frame() {
+        if (!frame)
+            throw std::runtime_error("hold_frame() called outside of a receive callback");
+        return frame;
+    }
+
     void request_blocks(uint32_t start_block_num, const std::vector<block_position>& positions) {
         get_blocks_request_v0 req;
         req.start_block_num        = start_block_num;
@@ -4,6 +4,8 @@
 #include "query_config.hpp"
 #include "state_history.hpp"
 
+#include <charconv>
+
 namespace state_history {
 namespace kv {
 
@@ -27,7 +29,7 @@ template <typename T, typename F>
 void fixup_key(std::vector<char>& bin, F f) {
     if constexpr (
         std::is_unsigned_v<T> || std::is_same_v<std::decay_t<T>, abieos::name> || std::is_same_v<std::decay_t<T>, abieos::uint128> ||
-        std::is_same_v<std::decay_t<T>, abieos::checksum256>)
+        std::is_same_v<std::decay_t<T>, abieos::checksum256> || std::is_same_v<std::decay_t<T>, transaction_status>)
         reverse_bin(bin, f);
     else
         throw std::runtime_error("unsupported key type");
@@ -65,6 +67,7 @@ struct type {
     bool (*skip_bin)(abieos::input_buffer&)                         = nullptr;
     bool (*skip_key)(abieos::input_buffer&)                         = nullptr;
     void (*fill_empty)(std::vector<char>&)                          = nullptr;
+    void (*string_to_key)(std::vector<char>&, const std::string&)   = nullptr;
 };
 
 template <typename T>
@@ -188,10 +191,37 @@ void fill_empty(std::vector<char>& dest) {
     }
 }
 
+// Converts a query condition's value to key form, which compares the same way as the field's values
+template <typename T>
+void string_to_key(std::vector<char>& dest, const std::string& s) {
+    std::vector<char> bin;
+    if constexpr (std::is_same_v<T, bool>) {
+        if (s != "true" && s != "false")
+            throw std::runtime_error("expected true or false: " + s);
+        abieos::native_to_bin(s == "true", bin);
+    } else if constexpr (std::is_unsigned_v<T> || std::is_same_v<T, abieos::varuint32>) {
+        using number = std::conditional_t<std::is_same_v<T, abieos::varuint32>, uint32_t, T>;
+
+        number value  = 0;
+        auto   result = std::from_chars(s.data(), s.data() + s.size(), value);
+        if (result.ec != std::errc{} || result.ptr != s.data() + s.size())
+            throw std::runtime_error("invalid number: " + s);
+        abieos::native_to_bin(T{value}, bin);
+    } else if constexpr (std::is_same_v<T, abieos::name>) {
+        abieos::native_to_bin(abieos::name{s.c_str()}, bin);
+    } else if constexpr (std::is_same_v<T, transaction_status>) {
+        bin.push_back((char)get_transaction_status(s));
+    } else {
+        throw std::runtime_error("unsupported condition type");
+    }
+    abieos::input_buffer b{bin.data(), bin.data() + bin.size()};
+    bin_to_key<T>(dest, b);
+}
+
 template <typename T>
 constexpr type make_type_for() {
     return type{bin_to_bin<T>,      bin_to_key<T>, key_to_key<T>, query_to_key<T>, lower_bound_key<T>,
-                upper_bound_key<T>, skip_bin<T>,   skip_key<T>,   fill_empty<T>};
+                upper_bound_key<T>, skip_bin<T>,   skip_key<T>,   fill_empty<T>,   string_to_key<T>};
 }
 
 // clang-format off
@@ -226,7 +256,7 @@ const inline std::map<std::string, type> abi_type_to_kv_type = {
 // Key                                                                          Value                               Notes   Description
 // =================================================================================================================================================
 // key_tag::table,  block_num, table_name, present_k, pk,               ## present_v,(fields iff present_v) ## 1,2  ## traces, deltas, reducer_outputs
-// key_tag::index,  table_name, index_name, key, ~block_num, !present_k ## (none)                           ## 1    ## indexes. key is superset of pk fields
+// key_tag::index,  table_name, index_name, key, ~block_num, !present_k ## (none) or covered fields         ## 1    ## indexes. key is superset of pk fields
 //
 // * Keys are serialized in a lexigraphical sort format. See native_to_key() and key_to_native().
 // * Erase range lower_bound(make_table_key(n)) to upper_bound(make_table_key()) to erase blocks >= n.
@@ -242,6 +272,10 @@ const inline std::map<std::string, type> abi_type_to_kv_type = {
 //   * nodeos deltas:     used
 //   * reducer outputs:   used
 //   * all other cases:   =1
+//
+// * covered fields (indexes with covering_fields); see covered_tag
+//   * covered_tag::row,    whole row
+//   * covered_tag::fields, (varuint32 field_index, field)... for the covered fields which are present
 
 enum class key_tag : uint8_t {
     table = 0x50,
@@ -363,6 +397,18 @@ inline void read_index_suffix(abieos::input_buffer& bin, uint32_t& block, bool&
     present_k = !key_to_native<bool>(bin);
 }
 
+enum class covered_tag : uint8_t {
+    row    = 1,
+    fields = 2,
+};
+
+// 0 if the entry has no covered fields, e.g. it was written before the index had covering_fields
+inline covered_tag get_covered_tag(abieos::input_buffer value) {
+    if (value.pos == value.end)
+        return {};
+    return (covered_tag)*value.pos;
+}
+
 inline std::vector<char> make_fill_status_key() { return make_table_key(0, true, "fill.status"_n); }
 
 struct received_block {
@@ -376,6 +422,9 @@ ABIEOS_REFLECT(received_block) {
 }
 
 inline std::vector<char> make_received_block_key(uint32_t block) { return make_table_key(block, true, "recvd.block"_n); }
+
+// Holds a received_block: the head at a clean shutdown. Nothing above it was written.
+inline std::vector<char> make_clean_shutdown_key() { return make_table_key(0, true, "fill.clean"_n); }
 inline std::vector<char> make_block_info_key(uint32_t block) { return make_table_key(block, true, "block.info"_n); }
 
 inline void append_transaction_trace_key(std::vector<char>& dest, uint32_t block, const abieos::checksum256 transaction_id) {
@@ -402,6 +451,10 @@ struct defs {
     using key   = query_config::key<defs>;
     using table = query_config::table<defs>;
 
+    struct condition : query_config::condition<defs> {
+        std::vector<char> value_key = {}; // value, in the same key form as the field
+    };
+
     struct config : query_config::config<defs> {
         template <typename M>
         void prepare(const M& type_map) {
@@ -409,6 +462,15 @@ struct defs {
             for (auto& table : tables)
                 for (uint32_t i = 0; i < table.fields.size(); ++i)
                     table.fields[i].field_index = i;
+            for (auto& query : queries) {
+                for (auto& cond : query.conditions) {
+                    try {
+                        cond.field->type_obj->string_to_key(cond.value_key, cond.value);
+                    } catch (std::exception& e) {
+                        throw std::runtime_error("query " + (std::string)query.short_name + " condition on " + cond.name + ": " + e.what());
+                    }
+                }
+            }
         }
     };
 }; // defs
@@ -495,6 +557,38 @@ inline void extract_keys(
     }
 }
 
+// Index entry value for an index with covering_fields
+inline void append_covered_fields(
+    std::vector<char>& dest, abieos::input_buffer value, const kv::index& index, std::vector<std::optional<uint32_t>>& positions) {
+    if (index.covers_row) {
+        dest.push_back((char)covered_tag::row);
+        dest.insert(dest.end(), value.pos, value.end);
+        return;
+    }
+    dest.push_back((char)covered_tag::fields);
+    for (auto* field : index.covered_fields) {
+        if (!positions.at(field->field_index))
+            continue;
+        abieos::push_varuint32(dest, field->field_index);
+        abieos::input_buffer b = {value.pos + *positions[field->field_index], value.end};
+        field->type_obj->bin_to_bin(dest, b);
+    }
+}
+
+// Positions of the fields in a covered_tag::fields value; value starts after the tag
+inline void fill_covered_positions(
+    abieos::input_buffer value, const std::vector<field>& fields, std::vector<std::optional<uint32_t>>& positions) {
+    auto begin = value.pos;
+    while (value.pos != value.end) {
+        auto field_index = abieos::read_varuint32(value);
+        if (field_index >= fields.size())
+            throw std::runtime_error("covered field index is out of range");
+        positions.at(field_index) = value.pos - begin;
+        if (!fields[field_index].type_obj->skip_bin(value))
+            throw std::runtime_error("covered field is truncated");
+    }
+}
+
 inline const char* fill_positions_from_index(
     abieos::input_buffer index, const std::vector<kv::key>& index_keys, uint32_t& block, bool& present_k,
     std::vector<std::optional<uint32_t>>& positions) {
@@ -74,6 +74,29 @@ inline std::string end_object_in_array(bool bulk) {
         return ")";
 }
 
+// Appends a field in COPY text form to an array literal as a quoted element, or NULL
+inline void append_array_element(std::string& dest, std::string_view field) {
+    if (field == "\\N") {
+        dest += "NULL";
+        return;
+    }
+    dest += '"';
+    for (size_t i = 0; i < field.size(); ++i) {
+        char ch = field[i];
+        if (ch == '\\' && i + 1 < field.size()) {
+            switch (ch = field[++i]) {
+            case 't': ch = '\t'; break;
+            case 'r': ch = '\r'; break;
+            case 'n': ch = '\n'; break;
+            }
+        }
+        if (ch == '"' || ch == '\\')
+            dest += '\\';
+        dest += ch;
+    }
+    dest += '"';
+}
+
 inline abieos::bytes sql_to_bytes(const char* ch) {
     abieos::bytes result;
     if (!ch || ch[0] != '\\' || ch[1] != 'x')
@@ -103,13 +126,19 @@ std::string sql_str(pqxx::connection& c, bool bulk, const T& obj);
 
 inline std::string sql_str(pqxx::connection& c, bool bulk, const std::string& s) {
     try {
+        // esc() also rejects strings which aren't valid in the connection's encoding. COPY text keeps quotes as they are but
+        // needs backslashes escaped.
         std::string tmp = c.esc(s);
+        if (bulk)
+            tmp = s;
         std::string result;
         result.reserve(tmp.size() + 2);
         if (!bulk)
             result += "'";
         for (auto ch : tmp) {
-            if (ch == '\t')
+            if (bulk && ch == '\\')
+                result += "\\\\";
+            else if (ch == '\t')
                 result += "\\t";
             else if (ch == '\r')
                 result += "\\r";
@@ -268,6 +297,239 @@ inline std::string empty_to_sql<abieos::input_buffer>(pqxx::connection&, bool bu
     return quote_bytea(bulk, "");
 }
 
+// PostgreSQL COPY binary format. Each value is an int32 byte length (-1 for null) followed by the value in
+// the type's binary send/recv representation. All integers are big-endian.
+
+inline constexpr uint32_t varchar_oid = 1043; // builtin oids are fixed
+inline constexpr uint32_t bytea_oid   = 17;
+
+inline constexpr int64_t pg_epoch_us = 946'684'800'000'000ll; // 2000-01-01 relative to 1970-01-01
+
+inline const char binary_copy_header[] = "PGCOPY\n\377\r\n\0\0\0\0\0\0\0\0\0";
+
+template <typename T>
+void push_binary(std::vector<char>& dest, T v) {
+    using U = std::make_unsigned_t<T>;
+    for (int i = sizeof(T) - 1; i >= 0; --i)
+        dest.push_back(char(U(v) >> (i * 8)));
+}
+
+template <typename T>
+void patch_binary(std::vector<char>& dest, size_t pos, T v) {
+    using U = std::make_unsigned_t<T>;
+    for (size_t i = 0; i < sizeof(T); ++i)
+        dest[pos + i] = char(U(v) >> ((sizeof(T) - 1 - i) * 8));
+}
+
+inline size_t begin_binary_value(std::vector<char>& dest) {
+    auto pos = dest.size();
+    push_binary<int32_t>(dest, 0);
+    return pos;
+}
+
+inline void end_binary_value(std::vector<char>& dest, size_t pos) {
+    auto size = dest.size() - pos - 4;
+    if ((int32_t)size != size)
+        throw std::runtime_error("value is too big for binary copy");
+    patch_binary<int32_t>(dest, pos, size);
+}
+
+inline void append_binary_null(std::vector<char>& dest) { push_binary<int32_t>(dest, -1); }
+
+inline void append_binary_raw(std::vector<char>& dest, const char* begin, const char* end) {
+    if ((int32_t)(end - begin) != end - begin)
+        throw std::runtime_error("value is too big for binary copy");
+    push_binary<int32_t>(dest, end - begin);
+    dest.insert(dest.end(), begin, end);
+}
+
+inline void append_binary_raw(std::vector<char>& dest, const std::string& s) { append_binary_raw(dest, s.data(), s.data() + s.size()); }
+
+template <typename T>
+void append_binary_int(std::vector<char>& dest, T v) {
+    push_binary<int32_t>(dest, sizeof(T));
+    push_binary<T>(dest, v);
+}
+
+// numeric: ndigits, weight, sign, dscale, then base-10000 digits, most significant first
+inline void append_binary_numeric(std::vector<char>& dest, bool negative, unsigned __int128 v) {
+    int16_t digits[10];
+    int     num_digits = 0;
+    while (v) {
+        digits[num_digits++] = v % 10000;
+        v /= 10000;
+    }
+    int num_trailing = 0;
+    while (num_trailing < num_digits && !digits[num_trailing])
+        ++num_trailing;
+    auto pos = begin_binary_value(dest);
+    push_binary<int16_t>(dest, num_digits - num_trailing);
+    push_binary<int16_t>(dest, num_digits ? num_digits - 1 : 0);
+    push_binary<uint16_t>(dest, negative ? 0x4000 : 0);
+    push_binary<int16_t>(dest, 0);
+    for (int i = num_digits - 1; i >= num_trailing; --i)
+        push_binary<int16_t>(dest, digits[i]);
+    end_binary_value(dest, pos);
+}
+
+inline unsigned __int128 to_native_uint128(const std::array<uint8_t, 16>& value) {
+    unsigned __int128 result;
+    memcpy(&result, value.data(), sizeof(result));
+    return result;
+}
+
+// varchar must hold valid UTF-8 without embedded nulls; anything else is stored as hex like sql_str does
+inline bool is_valid_utf8(const char* begin, const char* end) {
+    auto p = reinterpret_cast<const unsigned char*>(begin);
+    auto e = reinterpret_cast<const unsigned char*>(end);
+    while (p < e) {
+        unsigned char c = *p++;
+        if (!c)
+            return false;
+        if (c < 0x80)
+            continue;
+        int      extra;
+        uint32_t cp;
+        if ((c & 0xe0) == 0xc0)
+            extra = 1, cp = c & 0x1f;
+        else if ((c & 0xf0) == 0xe0)
+            extra = 2, cp = c & 0x0f;
+        else if ((c & 0xf8) == 0xf0)
+            extra = 3, cp = c & 0x07;
+        else
+            return false;
+        if (e - p < extra)
+            return false;
+        for (int i = 0; i < extra; ++i) {
+            if ((p[i] & 0xc0) != 0x80)
+                return false;
+            cp = (cp << 6) | (p[i] & 0x3f);
+        }
+        p += extra;
+        if ((extra == 1 && cp < 0x80) || (extra == 2 && cp < 0x800) || (extra == 3 && cp < 0x10000) || cp > 0x10ffff ||
+            (cp >= 0xd800 && cp <= 0xdfff))
+            return false;
+    }
+    return true;
+}
+
+inline void append_binary_string(std::vector<char>& dest, const char* begin, const char* end) {
+    if (is_valid_utf8(begin, end))
+        return append_binary_raw(dest, begin, end);
+    auto pos = begin_binary_value(dest);
+    abieos::hex(begin, end, std::back_inserter(dest));
+    end_binary_value(dest, pos);
+}
+
+inline void append_binary_timestamp(std::vector<char>& dest, uint64_t us_since_1970) {
+    if (!us_since_1970)
+        return append_binary_null(dest);
+    append_binary_int<int64_t>(dest, int64_t(us_since_1970) - pg_epoch_us);
+}
+
+// clang-format off
+inline void append_binary(std::vector<char>& dest, bool v)                              { push_binary<int32_t>(dest, 1); dest.push_back(v); }
+inline void append_binary(std::vector<char>& dest, uint8_t v)                           { append_binary_int<int16_t>(dest, v); }
+inline void append_binary(std::vector<char>& dest, int8_t v)                            { append_binary_int<int16_t>(dest, v); }
+inline void append_binary(std::vector<char>& dest, uint16_t v)                          { append_binary_int<int32_t>(dest, v); }
+inline void append_binary(std::vector<char>& dest, int16_t v)                           { append_binary_int<int16_t>(dest, v); }
+inline void append_binary(std::vector<char>& dest, uint32_t v)                          { append_binary_int<int64_t>(dest, v); }
+inline void append_binary(std::vector<char>& dest, int32_t v)                           { append_binary_int<int32_t>(dest, v); }
+inline void append_binary(std::vector<char>& dest, uint64_t v)                          { append_binary_numeric(dest, false, v); }
+inline void append_binary(std::vector<char>& dest, int64_t v)                           { append_binary_int<int64_t>(dest, v); }
+inline void append_binary(std::vector<char>& dest, double v)                            { uint64_t x; memcpy(&x, &v, sizeof(x)); append_binary_int<uint64_t>(dest, x); }
+inline void append_binary(std::vector<char>& dest, abieos::varuint32 v)                 { append_binary_int<int64_t>(dest, v.value); }
+inline void append_binary(std::vector<char>& dest, abieos::varint32 v)                  { append_binary_int<int32_t>(dest, v.value); }
+inline void append_binary(std::vector<char>& dest, const abieos::uint128& v)            { append_binary_numeric(dest, false, to_native_uint128(v.value)); }
+inline void append_binary(std::vector<char>& dest, const abieos::int128& v)             { auto x = to_native_uint128(v.value); bool neg = x >> 127; append_binary_numeric(dest, neg, neg ? ~x + 1 : x); }
+inline void append_binary(std::vector<char>& dest, const abieos::float128& v)           { append_binary_raw(dest, (const char*)v.value.data(), (const char*)v.value.data() + v.value.size()); }
+inline void append_binary(std::vector<char>& dest, abieos::name v)                      { append_binary_raw(dest, v.value ? std::string(v) : std::string()); }
+inline void append_binary(std::vector<char>& dest, abieos::time_point v)                { append_binary_timestamp(dest, v.microseconds); }
+inline void append_binary(std::vector<char>& dest, abieos::time_point_sec v)            { append_binary_timestamp(dest, v.utc_seconds * 1'000'000ull); }
+inline void append_binary(std::vector<char>& dest, abieos::block_timestamp v)           { if (v.slot) append_binary_int<int64_t>(dest, v.slot * 500'000ll); else append_binary_null(dest); }
+inline void append_binary(std::vector<char>& dest, const abieos::checksum256& v)        { append_binary_raw(dest, v.value == abieos::checksum256{}.value ? "" : std::string(v)); }
+inline void append_binary(std::vector<char>& dest, const abieos::public_key& v)         { append_binary_raw(dest, public_key_to_string(v)); }
+inline void append_binary(std::vector<char>& dest, const abieos::signature& v)          { append_binary_raw(dest, signature_to_string(v)); }
+inline void append_binary(std::vector<char>& dest, const std::string& v)                { append_binary_string(dest, v.data(), v.data() + v.size()); }
+inline void append_binary(std::vector<char>& dest, const abieos::bytes& v)              { append_binary_raw(dest, v.data.data(), v.data.data() + v.data.size()); }
+inline void append_binary(std::vector<char>& dest, const abieos::input_buffer& v)       { append_binary_raw(dest, v.pos, v.end); }
+inline void append_binary(std::vector<char>& dest, transaction_status v)                { append_binary_raw(dest, to_string(v)); }
+inline void append_binary(std::vector<char>& dest, abieos::symbol v)                    { append_binary_raw(dest, abieos::symbol_to_string(v.value)); }
+// clang-format on
+
+template <typename T>
+void append_binary(std::vector<char>& dest, const std::optional<T>& obj) {
+    if (obj)
+        append_binary(dest, *obj);
+    else if constexpr (std::is_arithmetic_v<T>)
+        append_binary(dest, T{});
+    else if constexpr (abieos::is_string_v<T>)
+        append_binary_raw(dest, "");
+    else
+        append_binary_null(dest);
+}
+
+// array of one dimension. f(i) appends element i.
+template <typename F>
+void append_binary_array(std::vector<char>& dest, uint32_t element_oid, uint32_t size, F f) {
+    auto pos = begin_binary_value(dest);
+    push_binary<int32_t>(dest, size ? 1 : 0); // ndim
+    push_binary<int32_t>(dest, 0);            // has nulls
+    push_binary<uint32_t>(dest, element_oid);
+    if (size) {
+        push_binary<int32_t>(dest, size);
+        push_binary<int32_t>(dest, 1); // lower bound
+    }
+    for (uint32_t i = 0; i < size; ++i)
+        f(i);
+    end_binary_value(dest, pos);
+}
+
+template <typename T>
+void bin_to_binary(std::vector<char>& dest, abieos::input_buffer& bin) {
+    if constexpr (abieos::is_optional_v<T>) {
+        if (abieos::read_raw<bool>(bin))
+            bin_to_binary<typename T::value_type>(dest, bin);
+        else
+            append_binary(dest, T{});
+    } else {
+        append_binary(dest, abieos::read_raw<T>(bin));
+    }
+}
+
+template <typename T>
+void native_to_binary(std::vector<char>& dest, const void* p) {
+    append_binary(dest, *reinterpret_cast<const T*>(p));
+}
+
+template <typename T>
+void empty_to_binary(std::vector<char>& dest) {
+    append_binary(dest, T{});
+}
+
+template <>
+inline void bin_to_binary<std::string>(std::vector<char>& dest, abieos::input_buffer& bin) {
+    auto size = abieos::read_varuint32(bin);
+    if (size > bin.end - bin.pos)
+        throw abieos::error("invalid string size");
+    append_binary_string(dest, bin.pos, bin.pos + size);
+    bin.pos += size;
+}
+
+template <>
+inline void bin_to_binary<abieos::bytes>(std::vector<char>& dest, abieos::input_buffer& bin) {
+    auto size = abieos::read_varuint32(bin);
+    if (size > bin.end - bin.pos)
+        throw abieos::error("invalid bytes size");
+    append_binary_raw(dest, bin.pos, bin.pos + size);
+    bin.pos += size;
+}
+
+template <>
+inline void bin_to_binary<abieos::input_buffer>(std::vector<char>& dest, abieos::input_buffer& bin) {
+    throw abieos::error("bin_to_binary: input_buffer unsupported");
+}
+
 inline abieos::time_point sql_to_time_point(std::string s) {
     if (s.empty())
         return {};
@@ -331,6 +593,9 @@ struct type {
     std::string (*native_to_sql)(pqxx::connection&, bool, const void*)        = nullptr;
     std::string (*empty_to_sql)(pqxx::connection&, bool)                      = nullptr;
     void (*sql_to_bin)(std::vector<char>& bin, const pqxx::field&)            = nullptr;
+    void (*bin_to_binary)(std::vector<char>&, abieos::input_buffer&)          = nullptr;
+    void (*native_to_binary)(std::vector<char>&, const void*)                 = nullptr;
+    void (*empty_to_binary)(std::vector<char>&)                               = nullptr;
 };
 
 template <typename T>
@@ -348,7 +613,8 @@ inline constexpr unknown_type<T> type_for;
 
 template <typename T>
 constexpr type make_type_for(const char* name) {
-    return type{name, bin_to_sql<T>, native_to_sql<T>, empty_to_sql<T>, sql_to_bin<T>};
+    return type{name,          bin_to_sql<T>,       native_to_sql<T>,  empty_to_sql<T>, sql_to_bin<T>,
+                bin_to_binary<T>, native_to_binary<T>, empty_to_binary<T>};
 }
 
 // clang-format off
@@ -426,13 +692,14 @@ inline const std::map<std::string_view, type> abi_type_to_sql_type = {
 // clang-format on
 
 struct defs {
-    using type   = pg::type;
-    using field  = query_config::field<defs>;
-    using key    = query_config::key<defs>;
-    using table  = query_config::table<defs>;
-    using index  = query_config::index<defs>;
-    using query  = query_config::query<defs>;
-    using config = query_config::config<defs>;
+    using type      = pg::type;
+    using field     = query_config::field<defs>;
+    using key       = query_config::key<defs>;
+    using table     = query_config::table<defs>;
+    using index     = query_config::index<defs>;
+    using query     = query_config::query<defs>;
+    using condition = query_config::condition<defs>;
+    using config    = query_config::config<defs>;
 }; // defs
 
 using field  = defs::field;
@@ -3,8 +3,11 @@
 #pragma once
 #include "state_history_kv.hpp"
 
+#include <algorithm>
 #include <boost/filesystem.hpp>
 #include <fc/exception/exception.hpp>
+#include <map>
+#include <mutex>
 #include <rocksdb/db.h>
 
 namespace state_history {
@@ -23,6 +26,7 @@ inline void check(rocksdb::Status s, const char* prefix) {
 struct database {
     std::shared_ptr<rocksdb::Statistics> stats;
     std::unique_ptr<rocksdb::DB>         db;
+    bool                                 wal = false; // write() skips the WAL unless set; durability then depends on flush()
 
     database(const char* db_path, std::optional<uint32_t> threads, std::optional<uint32_t> max_open_files, bool fast_reads) {
         rocksdb::DB*     p;
@@ -70,6 +74,8 @@ struct database {
         op.wait              = wait;
         db->Flush(op);
     }
+
+    void sync_wal() { check(db->SyncWAL(), "SyncWAL: "); }
 };
 
 inline rocksdb::Slice to_slice(const std::vector<char>& v) { return {v.data(), v.size()}; }
@@ -93,7 +99,7 @@ void put(rocksdb::WriteBatch& batch, const std::vector<char>& key, const T& valu
 inline void write(database& db, rocksdb::WriteBatch& batch) {
     // todo: verify status write order
     rocksdb::WriteOptions opt;
-    opt.disableWAL = true;
+    opt.disableWAL = !db.wal;
     check(db.db->Write(opt, &batch), "write batch");
     batch.Clear();
 }
@@ -199,5 +205,211 @@ void for_each_subkey(database& db, std::vector<char> lower_bound, const std::vec
     for_each_subkey(*it, std::move(lower_bound), upper_bound, f);
 }
 
+// Rows of reversible blocks, which fill-rocksdb can keep in memory instead of writing them to the database and undoing them
+// on forks. Content and index keys both include the block number, so each key belongs to a single block.
+//
+// Readers don't lock the overlay while they use it. Each block's rows are immutable once added; every change publishes a
+// new version listing the current blocks, which readers pin with get_version(). The other members are only used by
+// fill-rocksdb's thread.
+struct overlay {
+    using rows_type = std::map<std::string, std::string, std::less<>>;
+
+    struct version {
+        std::vector<std::shared_ptr<const rows_type>> maps       = {}; // content and index rows of each block, oldest first
+        std::shared_ptr<const rows_type>              other_rows = {}; // rows which don't belong to a block, e.g. fill_status
+
+        bool has_blocks() const { return !maps.empty(); }
+    };
+
+    struct block {
+        std::shared_ptr<const rows_type> content = {};
+        std::shared_ptr<const rows_type> index   = {};
+    };
+
+    struct collector : rocksdb::WriteBatch::Handler {
+        rows_type& rows;
+
+        collector(rows_type& rows)
+            : rows(rows) {}
+
+        void Put(const rocksdb::Slice& key, const rocksdb::Slice& value) override { rows[key.ToString()] = value.ToString(); }
+
+        void Delete(const rocksdb::Slice&) override { throw std::runtime_error("overlay: reversible blocks can't remove rows"); }
+    };
+
+    std::map<uint32_t, block>        blocks     = {};
+    std::shared_ptr<const rows_type> other_rows = std::make_shared<rows_type>();
+
+    std::shared_ptr<const version> get_version() {
+        std::lock_guard lock{mutex};
+        return current;
+    }
+
+    // Moves the batches' rows into the overlay and clears the batches
+    void add_block(uint32_t block_num, rocksdb::WriteBatch& content_batch, rocksdb::WriteBatch& index_batch) {
+        auto      content = std::make_shared<rows_type>();
+        auto      index   = std::make_shared<rows_type>();
+        collector content_collector{*content};
+        collector index_collector{*index};
+        check(content_batch.Iterate(&content_collector), "overlay: ");
+        check(index_batch.Iterate(&index_collector), "overlay: ");
+        content_batch.Clear();
+        index_batch.Clear();
+        blocks[block_num] = {std::move(content), std::move(index)};
+        publish();
+    }
+
+    // Sets a row which doesn't belong to a block, e.g. fill_status
+    void put(const std::vector<char>& key, const std::vector<char>& value) {
+        auto rows = std::make_shared<rows_type>(*other_rows);
+        rows->insert_or_assign(std::string{key.data(), key.size()}, std::string{value.data(), value.size()});
+        other_rows = std::move(rows);
+        publish();
+    }
+
+    std::optional<std::string> get(const std::vector<char>& key) {
+        std::string_view k{key.data(), key.size()};
+        auto             find = [&](const rows_type& rows) -> std::optional<std::string> {
+            if (auto it = rows.find(k); it != rows.end())
+                return it->second;
+            return {};
+        };
+        for (auto& [_, b] : blocks) {
+            if (auto v = find(*b.content))
+                return v;
+            if (auto v = find(*b.index))
+                return v;
+        }
+        return find(*other_rows);
+    }
+
+    // Writes blocks up to and including block_num to db and removes them from the overlay. Readers see the rows in the
+    // database before they disappear from the overlay.
+    void flush(database& db, uint32_t block_num) {
+        rocksdb::WriteBatch content_batch, index_batch;
+        auto                end = blocks.upper_bound(block_num);
+        for (auto it = blocks.begin(); it != end; ++it) {
+            for (auto& [k, v] : *it->second.content)
+                content_batch.Put(k, v);
+            for (auto& [k, v] : *it->second.index)
+                index_batch.Put(k, v);
+        }
+
+        // write content before indexes; see fill-rocksdb's end_write
+        rocksdb::WriteOptions opt;
+        opt.disableWAL = !db.wal;
+        check(db.db->Write(opt, &content_batch), "write batch");
+        check(db.db->Write(opt, &index_batch), "write batch");
+        blocks.erase(blocks.begin(), end);
+        publish();
+    }
+
+    // Drops blocks starting at block_num
+    void truncate(uint32_t block_num) {
+        blocks.erase(blocks.lower_bound(block_num), blocks.end());
+        publish();
+    }
+
+    void clear() {
+        blocks.clear();
+        other_rows = std::make_shared<rows_type>();
+        publish();
+    }
+
+  private:
+    std::mutex                     mutex;                                // guards current
+    std::shared_ptr<const version> current = std::make_shared<version>(); // what readers see
+
+    void publish() {
+        auto v = std::make_shared<version>();
+        for (auto& [_, b] : blocks) {
+            v->maps.push_back(b.content);
+            v->maps.push_back(b.index);
+        }
+        v->other_rows = other_rows;
+        std::lock_guard lock{mutex};
+        current = std::move(v);
+    }
+}; // overlay
+
+// Merges an overlay version's rows into a database iterator; overlay rows win when both have a key. The version's maps
+// never share a key, so they're merged with a heap. Only supports forward iteration, which is all the queries use.
+struct overlay_iterator : rocksdb::Iterator {
+    using rows_type = overlay::rows_type;
+    using cursor    = std::pair<rows_type::const_iterator, rows_type::const_iterator>; // position, end
+
+    std::unique_ptr<rocksdb::Iterator>      base;
+    std::shared_ptr<const overlay::version> version;
+    std::vector<cursor>                     heap     = {}; // cursors which aren't at their end; smallest key first
+    bool                                    use_rows = false;
+
+    overlay_iterator(std::unique_ptr<rocksdb::Iterator> base, std::shared_ptr<const overlay::version> version)
+        : base(std::move(base))
+        , version(std::move(version)) {}
+
+    bool Valid() const override { return use_rows || base->Valid(); }
+
+    void SeekToFirst() override {
+        base->SeekToFirst();
+        seek_rows([](const rows_type& rows) { return rows.begin(); });
+    }
+
+    void Seek(const rocksdb::Slice& target) override {
+        base->Seek(target);
+        std::string_view t{target.data(), target.size()};
+        seek_rows([&](const rows_type& rows) { return rows.lower_bound(t); });
+    }
+
+    void Next() override {
+        if (use_rows) {
+            if (base->Valid() && base->key() == rocksdb::Slice{heap.front().first->first})
+                base->Next();
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            if (++heap.back().first == heap.back().second)
+                heap.pop_back();
+            else
+                std::push_heap(heap.begin(), heap.end(), greater);
+        } else {
+            base->Next();
+        }
+        select();
+    }
+
+    void SeekToLast() override { throw std::runtime_error("overlay_iterator: reverse iteration is not supported"); }
+    void SeekForPrev(const rocksdb::Slice&) override { throw std::runtime_error("overlay_iterator: reverse iteration is not supported"); }
+    void Prev() override { throw std::runtime_error("overlay_iterator: reverse iteration is not supported"); }
+
+    rocksdb::Slice  key() const override { return use_rows ? rocksdb::Slice{heap.front().first->first} : base->key(); }
+    rocksdb::Slice  value() const override { return use_rows ? rocksdb::Slice{heap.front().first->second} : base->value(); }
+    rocksdb::Status status() const override { return base->status(); }
+
+  private:
+    static bool greater(const cursor& a, const cursor& b) { return a.first->first > b.first->first; }
+
+    template <typename F>
+    void seek_rows(F start) {
+        heap.clear();
+        auto add = [&](const rows_type& rows) {
+            auto it = start(rows);
+            if (it != rows.end())
+                heap.push_back({it, rows.end()});
+        };
+        for (auto& rows : version->maps)
+            add(*rows);
+        add(*version->other_rows);
+        std::make_heap(heap.begin(), heap.end(), greater);
+        select();
+    }
+
+    void select() {
+        if (heap.empty())
+            use_rows = false;
+        else if (!base->Valid())
+            use_rows = true;
+        else
+            use_rows = rocksdb::Slice{heap.front().first->first}.compare(base->key()) <= 0;
+    }
+}; // overlay_iterator
+
 } // namespace rdb
 } // namespace state_history
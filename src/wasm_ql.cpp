@@ -4,18 +4,39 @@
 
 #include <fc/log/logger.hpp>
 #include <fc/scoped_exit.hpp>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <sys/stat.h>
+#include <unordered_map>
 
 using namespace abieos::literals;
 
 namespace wasm_ql {
 
 struct callbacks;
-using backend_t = eosio::vm::backend<callbacks>;
-using rhf_t     = eosio::vm::registered_host_functions<callbacks>;
+using backend_t = eosio::vm::backend<callbacks, eosio::vm::interpreter>;
+#ifdef __x86_64__
+using jit_backend_t = eosio::vm::backend<callbacks, eosio::vm::jit>;
+#endif
+using rhf_t = eosio::vm::registered_host_functions<callbacks>;
 
+// Function index of a table element. Newer eos-vm versions store the function's type alongside its index.
+template <typename T>
+static uint32_t table_function(const T& elem) {
+    if constexpr (std::is_integral_v<T>)
+        return elem;
+    else
+        return elem.index;
+}
+
+// Both backends share these host functions; only one of the backend pointers is set
 struct callbacks {
     wasm_ql::thread_state& thread_state;
-    backend_t&             backend;
+    backend_t*             backend = nullptr;
+#ifdef __x86_64__
+    jit_backend_t* jit_backend = nullptr;
+#endif
 
     void check_bounds(const char* begin, const char* end) {
         if (begin > end)
@@ -25,8 +46,19 @@ struct callbacks {
 
     char* alloc(uint32_t cb_alloc_data, uint32_t cb_alloc, uint32_t size) {
         // todo: verify cb_alloc isn't in imports
-        auto result = backend.get_context().execute_func_table(
-            this, eosio::vm::interpret_visitor(backend.get_context()), cb_alloc, cb_alloc_data, size);
+        std::optional<eosio::vm::operand_stack_elem> result;
+        if (backend) {
+            result = backend->get_context().execute_func_table(
+                this, eosio::vm::interpret_visitor(backend->get_context()), cb_alloc, cb_alloc_data, size);
+        } else {
+#ifdef __x86_64__
+            auto& table = jit_backend->get_module().tables.at(0).table;
+            if (cb_alloc >= table.size())
+                throw std::runtime_error("cb_alloc is out of range");
+            result = jit_backend->get_context().execute(
+                this, eosio::vm::jit_visitor(42), table_function(table[cb_alloc]), cb_alloc_data, size);
+#endif
+        }
         if (!result || !result->is_a<eosio::vm::i32_const_t>())
             throw std::runtime_error("cb_alloc returned incorrect type");
         char* begin = thread_state.wa.get_base_ptr<char>() + result->to_ui32();
@@ -43,6 +75,7 @@ struct callbacks {
     }
 
     void get_database_status(uint32_t cb_alloc_data, uint32_t cb_alloc) {
+        thread_state.max_block = 0xffff'ffff;
         auto data = alloc(cb_alloc_data, cb_alloc, thread_state.database_status.size());
         memcpy(data, thread_state.database_status.data(), thread_state.database_status.size());
     }
@@ -59,9 +92,25 @@ struct callbacks {
 
     void query_database(const char* req_begin, const char* req_end, uint32_t cb_alloc_data, uint32_t cb_alloc) {
         check_bounds(req_begin, req_end);
-        auto result = thread_state.query_session->query_database({req_begin, req_end}, thread_state.fill_status.head);
-        auto data   = alloc(cb_alloc_data, cb_alloc, result.size());
-        memcpy(data, result.data(), result.size());
+        auto&    rows      = thread_state.query_rows;
+        uint32_t max_block = 0;
+        rows.clear();
+        auto num_rows = thread_state.query_session->query_database({req_begin, req_end}, thread_state.fill_status.head, max_block, rows);
+        thread_state.max_block = std::max(thread_state.max_block, max_block);
+
+        // the WASM receives a serialized vector: a varuint32 row count followed by the rows
+        char  count[5];
+        char* count_end = count;
+        do {
+            *count_end++ = char((num_rows & 0x7f) | (num_rows >= 0x80 ? 0x80 : 0));
+            num_rows >>= 7;
+        } while (num_rows);
+        auto count_size = count_end - count;
+        if (rows.size() + count_size > 0xffff'ffff)
+            throw std::runtime_error("query_database: result is too big");
+        auto data = alloc(cb_alloc_data, cb_alloc, count_size + rows.size());
+        memcpy(data, count, count_size);
+        memcpy(data + count_size, rows.data(), rows.size());
     }
 
     void print_range(const char* begin, const char* end) {
@@ -92,6 +141,8 @@ static void fill_context_data(wasm_ql::thread_state& thread_state) {
 
 // todo: detect thread_state.fill_status.first changing (history trim)
 static bool did_fork(wasm_ql::thread_state& thread_state) {
+    if (thread_state.query_session->uses_snapshot())
+        return false;
     auto id = thread_state.query_session->get_block_id(thread_state.fill_status.head);
     if (!id) {
         ilog("fork detected (prev head not found)");
@@ -108,9 +159,12 @@ template <typename F>
 static void retry_loop(wasm_ql::thread_state& thread_state, F f) {
     int num_tries = 0;
     while (true) {
-        auto exit                  = fc::make_scoped_exit([&] { thread_state.query_session.reset(); });
-        thread_state.query_session = thread_state.shared->db_iface->create_query_session();
-        thread_state.fill_status   = thread_state.query_session->get_fill_status();
+        // the session (and for PostgreSQL, its connection) stays with the thread_state for later requests
+        if (!thread_state.query_session)
+            thread_state.query_session = thread_state.shared->db_iface->create_query_session();
+        auto exit = fc::make_scoped_exit([&] { thread_state.query_session->end_request(); });
+        thread_state.query_session->begin_request();
+        thread_state.fill_status = thread_state.query_session->get_fill_status();
         if (!thread_state.fill_status.head)
             throw std::runtime_error("database is empty");
         fill_context_data(thread_state);
@@ -122,18 +176,220 @@ static void retry_loop(wasm_ql::thread_state& thread_state, F f) {
     }
 }
 
-static void run_query(wasm_ql::thread_state& thread_state, abieos::name short_name) {
-    auto      code = backend_t::read_wasm(thread_state.shared->wasm_dir + "/" + (std::string)short_name + "-server.wasm");
-    backend_t backend(code);
-    callbacks cb{thread_state, backend};
-    backend.set_wasm_allocator(&thread_state.wa);
+// A backend holds execution state, so parsed modules can't be shared between threads. Each thread_state keeps its own,
+// which are reparsed when the file's inode, size, or mtime changes.
+//
+// env.initialize runs the module's global constructors. Its result doesn't depend on the request, so linear memory is
+// captured after the first run and copied back for later requests instead. The only mutable global clang emits is the
+// stack pointer, which is back at its initial value once initialize returns; backend.initialize() resets it.
+struct backend_cache {
+    struct entry {
+        ino_t                      inode          = {};
+        off_t                      size           = {};
+        int64_t                    mtime_ns       = {};
+        eosio::vm::wasm_code       code           = {};
+        std::unique_ptr<backend_t> backend        = {};
+        bool                       have_snapshot  = false;
+        int32_t                    snapshot_pages = 0;
+        std::vector<char>          snapshot       = {};
+
+        std::unique_ptr<backend_t>& get(backend_t*) { return backend; }
+
+#ifdef __x86_64__
+        std::unique_ptr<jit_backend_t> jit_backend = {}; // holds the compiled code
+
+        std::unique_ptr<jit_backend_t>& get(jit_backend_t*) { return jit_backend; }
+#endif
+    };
+
+    std::map<uint64_t, entry> entries = {}; // by query name
+};
+
+template <typename Backend>
+static backend_cache::entry& load_backend(wasm_ql::thread_state& thread_state, abieos::name short_name) {
+    if (!thread_state.backends)
+        thread_state.backends = std::make_shared<backend_cache>();
+    auto        filename = thread_state.shared->wasm_dir + "/" + (std::string)short_name + "-server.wasm";
+    struct stat st;
+    if (stat(filename.c_str(), &st)) {
+        thread_state.backends->entries.erase(short_name.value);
+        throw std::runtime_error("can not read " + (std::string)short_name + "-server.wasm");
+    }
+
+    auto& entry    = thread_state.backends->entries[short_name.value];
+    auto& backend  = entry.get((Backend*)nullptr);
+    auto  mtime_ns = int64_t(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+    if (!backend || entry.inode != st.st_ino || entry.size != st.st_size || entry.mtime_ns != mtime_ns) {
+        backend.reset();
+        entry.code = Backend::read_wasm(filename);
+        backend    = std::make_unique<Backend>(entry.code);
+        backend->set_wasm_allocator(&thread_state.wa);
+        rhf_t::resolve(backend->get_module());
+        entry.inode         = st.st_ino;
+        entry.size          = st.st_size;
+        entry.mtime_ns      = mtime_ns;
+        entry.have_snapshot = false;
+    }
+    return entry;
+}
+
+static backend_cache::entry& load_backend(wasm_ql::thread_state& thread_state, abieos::name short_name) {
+#ifdef __x86_64__
+    if (thread_state.shared->jit)
+        return load_backend<jit_backend_t>(thread_state, short_name);
+#endif
+    return load_backend<backend_t>(thread_state, short_name);
+}
 
-    rhf_t::resolve(backend.get_module());
+template <typename Backend>
+static void run_query(Backend& backend, backend_cache::entry& entry, callbacks& cb) {
+    // resets memory and globals left over from the previous request
     backend.initialize(&cb);
-    backend(&cb, "env", "initialize");
+
+    auto& ctx    = backend.get_context();
+    auto* memory = cb.thread_state.wa.get_base_ptr<char>();
+    if (entry.have_snapshot) {
+        auto grow = entry.snapshot_pages - ctx.current_linear_memory();
+        if (grow > 0 && ctx.grow_linear_memory(grow) < 0)
+            throw std::runtime_error("can not restore memory snapshot");
+        memcpy(memory, entry.snapshot.data(), entry.snapshot.size());
+    } else {
+        backend(&cb, "env", "initialize");
+        entry.snapshot_pages = ctx.current_linear_memory();
+        entry.snapshot.assign(memory, memory + size_t(entry.snapshot_pages) * eosio::vm::page_size);
+        entry.have_snapshot = true;
+    }
     backend(&cb, "env", "run_query");
 }
 
+static void run_query(wasm_ql::thread_state& thread_state, backend_cache::entry& entry) {
+    thread_state.max_block = 0;
+#ifdef __x86_64__
+    if (thread_state.shared->jit) {
+        callbacks cb{thread_state, nullptr, entry.jit_backend.get()};
+        return run_query(*entry.jit_backend, entry, cb);
+    }
+#endif
+    callbacks cb{thread_state, entry.backend.get()};
+    run_query(*entry.backend, entry, cb);
+}
+
+// Replies keyed by query name, the WASM file's identity (inode, size, mtime), and request. A reply which only depends on
+// blocks at or below irreversible stays valid until it's evicted or the filler trims history (first changes); any other
+// reply is only reused while head and head_id are unchanged.
+struct result_cache {
+    static constexpr size_t   num_shards     = 16;
+    static constexpr size_t   entry_overhead = 128; // approximate bookkeeping cost of an entry
+    static constexpr uint64_t log_interval   = 100'000;
+
+    struct entry {
+        std::string         key          = {};
+        std::vector<char>   reply        = {};
+        bool                irreversible = {};
+        uint32_t            first        = {};
+        uint32_t            head         = {};
+        abieos::checksum256 head_id      = {};
+
+        size_t cost() const { return key.size() + reply.size() + entry_overhead; }
+    };
+
+    struct shard {
+        std::mutex                                                       mutex = {};
+        std::list<entry>                                                 lru   = {}; // most recently used first
+        std::unordered_map<std::string_view, std::list<entry>::iterator> index = {}; // keys point into lru
+        size_t                                                           size  = {};
+    };
+
+    size_t                        max_shard_size = {};
+    std::array<shard, num_shards> shards         = {};
+    std::atomic<uint64_t>         hits           = {};
+    std::atomic<uint64_t>         misses         = {};
+
+    shard& get_shard(const std::string& key) { return shards[std::hash<std::string>{}(key) % num_shards]; }
+
+    static void erase(shard& s, decltype(shard::index)::iterator it) {
+        auto lru_it = it->second;
+        s.size -= lru_it->cost();
+        s.index.erase(it);
+        s.lru.erase(lru_it);
+    }
+
+    void count(bool hit) {
+        auto h = hit ? ++hits : hits.load();
+        auto m = hit ? misses.load() : ++misses;
+        if ((h + m) % log_interval == 0)
+            ilog("result cache: ${h} hits, ${m} misses", ("h", h)("m", m));
+    }
+
+    bool get(const std::string& key, const state_history::fill_status& status, std::vector<char>& reply) {
+        auto& s     = get_shard(key);
+        bool  found = false;
+        {
+            std::lock_guard lock{s.mutex};
+            auto            it = s.index.find(key);
+            if (it != s.index.end()) {
+                auto& e     = *it->second;
+                bool  valid = e.irreversible ? e.first == status.first : e.head == status.head && e.head_id.value == status.head_id.value;
+                if (valid) {
+                    s.lru.splice(s.lru.begin(), s.lru, it->second);
+                    reply = e.reply;
+                    found = true;
+                } else {
+                    erase(s, it);
+                }
+            }
+        }
+        count(found);
+        return found;
+    }
+
+    void put(std::string key, const state_history::fill_status& status, uint32_t max_block, const std::vector<char>& reply) {
+        if (key.size() + reply.size() + entry_overhead > max_shard_size)
+            return;
+        auto&           s = get_shard(key);
+        std::lock_guard lock{s.mutex};
+        if (auto it = s.index.find(key); it != s.index.end())
+            erase(s, it);
+        s.lru.push_front(entry{std::move(key), reply, max_block <= status.irreversible, status.first, status.head, status.head_id});
+        s.index[s.lru.front().key] = s.lru.begin();
+        s.size += s.lru.front().cost();
+        while (s.size > max_shard_size)
+            erase(s, s.index.find(s.lru.back().key));
+    }
+}; // result_cache
+
+std::shared_ptr<result_cache> create_result_cache(uint64_t max_bytes) {
+    auto cache            = std::make_shared<result_cache>();
+    cache->max_shard_size = max_bytes / result_cache::num_shards;
+    return cache;
+}
+
+// Runs a query, or fetches its reply from the cache. Returns false if a fork happened while the query ran.
+static bool run_cached_query(wasm_ql::thread_state& thread_state, abieos::name short_name) {
+    auto& entry = load_backend(thread_state, short_name);
+    auto* cache = thread_state.shared->cache.get();
+    if (!cache) {
+        run_query(thread_state, entry);
+        return !did_fork(thread_state);
+    }
+
+    std::string key;
+    key.reserve(40 + (thread_state.request.end - thread_state.request.pos));
+    key.append((const char*)&short_name.value, sizeof(short_name.value));
+    key.append((const char*)&entry.inode, sizeof(entry.inode));
+    key.append((const char*)&entry.size, sizeof(entry.size));
+    key.append((const char*)&entry.mtime_ns, sizeof(entry.mtime_ns));
+    key.append(thread_state.request.pos, thread_state.request.end);
+    if (cache->get(key, thread_state.fill_status, thread_state.reply))
+        return true;
+
+    run_query(thread_state, entry);
+    if (did_fork(thread_state))
+        return false;
+    cache->put(std::move(key), thread_state.fill_status, thread_state.max_block, thread_state.reply);
+    return true;
+}
+
 std::vector<char> query(wasm_ql::thread_state& thread_state, const std::vector<char>& request) {
     std::vector<char> result;
     retry_loop(thread_state, [&]() {
@@ -148,8 +404,7 @@ std::vector<char> query(wasm_ql::thread_state& thread_state, const std::vector<c
                 throw std::runtime_error("unknown namespace: " + (std::string)ns_name);
             auto short_name = abieos::bin_to_native<abieos::name>(thread_state.request);
 
-            run_query(thread_state, short_name);
-            if (did_fork(thread_state))
+            if (!run_cached_query(thread_state, short_name))
                 return false;
 
             // elog("result: ${s} ${x}", ("s", thread_state.reply.size())("x", fc::to_hex(thread_state.reply)));
@@ -166,10 +421,7 @@ const std::vector<char>& legacy_query(wasm_ql::thread_state& thread_state, const
     abieos::native_to_bin(target, req);
     abieos::native_to_bin(request, req);
     thread_state.request = abieos::input_buffer{req.data(), req.data() + req.size()};
-    retry_loop(thread_state, [&]() {
-        run_query(thread_state, "legacy"_n);
-        return !did_fork(thread_state);
-    });
+    retry_loop(thread_state, [&]() { return run_cached_query(thread_state, "legacy"_n); });
     return thread_state.reply;
 }
 
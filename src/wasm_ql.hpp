@@ -7,14 +7,20 @@
 
 namespace wasm_ql {
 
+struct result_cache;
+
 struct shared_state {
     bool                                console      = {};
+    bool                                jit          = {};
     std::string                         allow_origin = {};
     std::string                         wasm_dir     = {};
     std::string                         static_dir   = {};
     std::shared_ptr<database_interface> db_iface     = {};
+    std::shared_ptr<result_cache>       cache        = {}; // null if disabled
 };
 
+struct backend_cache;
+
 struct thread_state {
     std::shared_ptr<const shared_state> shared          = {};
     eosio::vm::wasm_allocator           wa              = {};
@@ -22,11 +28,16 @@ struct thread_state {
     abieos::input_buffer                request         = {}; // todo: rename
     std::vector<char>                   reply           = {}; // todo: rename
     std::unique_ptr<::query_session>    query_session   = {};
+    std::vector<char>                   query_rows      = {}; // reused by query_database to avoid per-call allocations
     state_history::fill_status          fill_status     = {};
+    std::shared_ptr<backend_cache>      backends        = {}; // parsed modules, reused across requests
+    uint32_t                            max_block       = {}; // highest block the current query's reply may depend on
 };
 
-void                     register_callbacks();
-std::vector<char>        query(wasm_ql::thread_state& thread_state, const std::vector<char>& request);
-const std::vector<char>& legacy_query(wasm_ql::thread_state& thread_state, const std::string& target, const std::vector<char>& request);
+std::shared_ptr<result_cache> create_result_cache(uint64_t max_bytes);
+void                          register_callbacks();
+std::vector<char>             query(wasm_ql::thread_state& thread_state, const std::vector<char>& request);
+const std::vector<char>&      legacy_query(
+    wasm_ql::thread_state& thread_state, const std::string& target, const std::vector<char>& request);
 
 } // namespace wasm_ql
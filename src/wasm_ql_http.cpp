@@ -65,6 +65,21 @@ class thread_state_cache {
         std::lock_guard<std::mutex> lock{mutex};
         states.push_back(std::move(state));
     }
+
+    // The state goes back to the pool even if f throws, so failing requests don't discard parsed or compiled WASMs. The
+    // query session is dropped in that case since it may have failed part way.
+    template <typename F>
+    void use_state(F f) {
+        auto state = get_state();
+        try {
+            f(*state);
+        } catch (...) {
+            state->query_session.reset();
+            store_state(std::move(state));
+            throw;
+        }
+        store_state(std::move(state));
+    }
 };
 
 // Report a failure
@@ -206,16 +221,14 @@ void handle_request(
         if (req.target() == "/wasmql/v1/query") {
             if (req.method() != http::verb::post)
                 return send(error(http::status::bad_request, "Unsupported HTTP-method for " + req.target().to_string() + "\n"));
-            auto thread_state = state_cache->get_state();
-            send(ok(query(*thread_state, req.body()), "application/octet-stream"));
-            state_cache->store_state(std::move(thread_state));
+            state_cache->use_state([&](thread_state& state) { send(ok(query(state, req.body()), "application/octet-stream")); });
             return;
         } else if (req.target().starts_with("/v1/")) {
             if (req.method() != http::verb::post)
                 return send(error(http::status::bad_request, "Unsupported HTTP-method for " + req.target().to_string() + "\n"));
-            auto thread_state = state_cache->get_state();
-            send(ok(legacy_query(*thread_state, req.target().to_string(), req.body()), "application/octet-stream"));
-            state_cache->store_state(std::move(thread_state));
+            state_cache->use_state([&](thread_state& state) {
+                send(ok(legacy_query(state, req.target().to_string(), req.body()), "application/octet-stream"));
+            });
             return;
         } else if (doc_root.empty()) {
             return send(error(http::status::not_found, "The resource '" + req.target().to_string() + "' was not found.\n"));
@@ -26,6 +26,10 @@ struct pg_query_session : query_session {
     std::shared_ptr<pg_database_interface> db_iface;
     pqxx::connection                       sql_connection = {};
 
+    virtual void begin_request() override {}
+    virtual void end_request() override {}
+    virtual bool uses_snapshot() override { return false; }
+
     virtual state_history::fill_status get_fill_status() override {
         pqxx::work t(sql_connection);
         auto row = t.exec("select head, head_id, irreversible, irreversible_id, first from \"" + db_iface->schema + "\".fill_status")[0];
@@ -48,7 +52,7 @@ struct pg_query_session : query_session {
         return pg::sql_to_checksum256(result[0][0].c_str());
     }
 
-    virtual std::vector<char> query_database(abieos::input_buffer query_bin, uint32_t head) override {
+    virtual uint32_t query_database(abieos::input_buffer query_bin, uint32_t head, uint32_t& max_block, std::vector<char>& rows) override {
         abieos::name query_name;
         abieos::bin_to_native(query_name, query_bin);
 
@@ -59,8 +63,11 @@ struct pg_query_session : query_session {
         const pg::query& query = *it->second;
 
         uint32_t snapshot_block_num = 0;
-        if (query.has_block_snapshot)
-            snapshot_block_num = std::min(head, abieos::bin_to_native<uint32_t>(query_bin));
+        max_block                   = 0xffff'ffff;
+        if (query.has_block_snapshot) {
+            max_block          = abieos::bin_to_native<uint32_t>(query_bin);
+            snapshot_block_num = std::min(head, max_block);
+        }
         std::string query_str = "select * from \"" + db_iface->schema + "\"." + query.function + "(";
         bool        need_sep  = false;
         if (query.has_block_snapshot) {
@@ -84,9 +91,7 @@ struct pg_query_session : query_session {
 
         pqxx::work        t(sql_connection);
         auto              exec_result = t.exec(query_str);
-        std::vector<char> result;
         std::vector<char> row_bin;
-        abieos::push_varuint32(result, exec_result.size());
         for (const auto& r : exec_result) {
             row_bin.clear();
             int i = 0;
@@ -104,13 +109,11 @@ struct pg_query_session : query_session {
             }
             if ((uint32_t)row_bin.size() != row_bin.size())
                 throw std::runtime_error("query_database: row is too big");
-            abieos::push_varuint32(result, row_bin.size());
-            result.insert(result.end(), row_bin.begin(), row_bin.end());
+            abieos::push_varuint32(rows, row_bin.size());
+            rows.insert(rows.end(), row_bin.begin(), row_bin.end());
         }
         t.commit();
-        if ((uint32_t)result.size() != result.size())
-            throw std::runtime_error("query_database: result is too big");
-        return result;
+        return exec_result.size();
     }
 }; // pg_query_session
 
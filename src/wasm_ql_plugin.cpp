@@ -61,6 +61,8 @@ void wasm_ql_plugin::set_program_options(options_description& cli, options_descr
     op("wql-wasm-dir", bpo::value<std::string>()->default_value("."), "Directory to fetch WASMs from");
     op("wql-static-dir", bpo::value<std::string>(), "Directory to serve static files from (default: disabled)");
     op("wql-console", "Show console output");
+    op("wql-vm", bpo::value<std::string>()->default_value("interpreter"), "WASM runtime: interpreter or jit (x86-64 only)");
+    op("wql-cache-size", bpo::value<uint64_t>()->default_value(0), "Memory limit for cached query results in MiB (0 to disable)");
 }
 
 void wasm_ql_plugin::plugin_initialize(const variables_map& options) {
@@ -80,6 +82,20 @@ void wasm_ql_plugin::plugin_initialize(const variables_map& options) {
         if (options.count("wql-static-dir"))
             my->state->static_dir = options.at("wql-static-dir").as<std::string>();
 
+        auto vm = options.at("wql-vm").as<std::string>();
+        if (vm == "jit") {
+#ifdef __x86_64__
+            my->state->jit = true;
+#else
+            throw std::runtime_error("--wql-vm jit is only available on x86-64");
+#endif
+        } else if (vm != "interpreter") {
+            throw std::runtime_error("invalid --wql-vm value: " + vm);
+        }
+
+        if (auto cache_size = options.at("wql-cache-size").as<uint64_t>())
+            my->state->cache = create_result_cache(cache_size * 1024 * 1024);
+
         register_callbacks();
     }
     FC_LOG_AND_RETHROW()
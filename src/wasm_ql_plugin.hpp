@@ -9,9 +9,19 @@
 struct query_session {
     virtual ~query_session() {}
 
-    virtual state_history::fill_status         get_fill_status()                                         = 0;
-    virtual std::optional<abieos::checksum256> get_block_id(uint32_t block_num)                          = 0;
-    virtual std::vector<char>                  query_database(abieos::input_buffer query, uint32_t head) = 0;
+    // Sessions are reused across requests. end_request() releases anything a request pinned, such as snapshots.
+    virtual void begin_request() = 0;
+    virtual void end_request()   = 0;
+
+    // true if the session reads from one consistent view of the database, so requests can't observe a fork
+    virtual bool uses_snapshot() = 0;
+
+    virtual state_history::fill_status         get_fill_status()                = 0;
+    virtual std::optional<abieos::checksum256> get_block_id(uint32_t block_num) = 0;
+
+    // Appends each row (size-prefixed) to rows and returns the number of rows. max_block receives the highest block the
+    // result may depend on, or 0xffff'ffff if the result follows head.
+    virtual uint32_t query_database(abieos::input_buffer query, uint32_t head, uint32_t& max_block, std::vector<char>& rows) = 0;
 };
 
 struct database_interface {
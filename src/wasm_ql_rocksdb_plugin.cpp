@@ -19,36 +19,61 @@ struct rocksdb_database_interface : database_interface, std::enable_shared_from_
     virtual std::unique_ptr<query_session> create_query_session();
 };
 
+// Sessions stay with their thread_state between requests. Iterators are created on first use within a request, so a query
+// needs at most 3 instead of 6; they're dropped at the end of the request so idle sessions don't pin memtables.
 struct rocksdb_query_session : query_session {
-    std::shared_ptr<rocksdb_database_interface> db_iface;
-    state_history::fill_status                  fill_status;
-    std::unique_ptr<rocksdb::Iterator>          it_for_get;
-    std::unique_ptr<rocksdb::Iterator>          it0;
-    std::unique_ptr<rocksdb::Iterator>          it1;
-    std::unique_ptr<rocksdb::Iterator>          it2;
-    std::unique_ptr<rocksdb::Iterator>          it3;
-    std::unique_ptr<rocksdb::Iterator>          it4;
+    std::shared_ptr<rocksdb_database_interface>     db_iface;
+    state_history::fill_status                      fill_status;
+    std::shared_ptr<const rdb::overlay::version>    overlay_version; // null if the overlay has no blocks
+    std::optional<rocksdb::ManagedSnapshot>         snapshot;
+    std::vector<std::unique_ptr<rocksdb::Iterator>> iterators; // 0: gets; 1, 2: index scans
+    std::vector<char>                               condition_key;
 
     rocksdb_query_session(const std::shared_ptr<rocksdb_database_interface>& db_iface)
-        : db_iface(db_iface)
-        , it_for_get{db_iface->rocksdb_inst->database.db->NewIterator(rocksdb::ReadOptions())}
-        , it0{db_iface->rocksdb_inst->database.db->NewIterator(rocksdb::ReadOptions())}
-        , it1{db_iface->rocksdb_inst->database.db->NewIterator(rocksdb::ReadOptions())}
-        , it2{db_iface->rocksdb_inst->database.db->NewIterator(rocksdb::ReadOptions())}
-        , it3{db_iface->rocksdb_inst->database.db->NewIterator(rocksdb::ReadOptions())}
-        , it4{db_iface->rocksdb_inst->database.db->NewIterator(rocksdb::ReadOptions())} {
-
-        auto f = rdb::get<state_history::fill_status>(*it_for_get, kv::make_fill_status_key(), false);
+        : db_iface(db_iface) {}
+
+    virtual ~rocksdb_query_session() {}
+
+    virtual void begin_request() override {
+        // The version is pinned before the snapshot. The filler writes blocks to the database before it publishes a version
+        // without them, so each block is in one or the other (or both, with the same rows).
+        overlay_version = db_iface->rocksdb_inst->overlay.get_version();
+        if (!overlay_version->has_blocks())
+            overlay_version.reset();
+        snapshot.emplace(db_iface->rocksdb_inst->database.db.get());
+
+        fill_status = {};
+        auto f      = rdb::get<state_history::fill_status>(iterator(0), kv::make_fill_status_key(), false);
         if (f)
             fill_status = *f;
     }
 
-    virtual ~rocksdb_query_session() {}
+    virtual void end_request() override {
+        iterators.clear();
+        snapshot.reset();
+        overlay_version.reset();
+    }
+
+    // All iterators read from one snapshot, so fill_status, block ids, and query results agree even while the filler writes
+    rocksdb::Iterator& iterator(size_t index) {
+        if (index >= iterators.size())
+            iterators.resize(index + 1);
+        auto& it = iterators[index];
+        if (!it) {
+            rocksdb::ReadOptions options;
+            options.snapshot = snapshot->snapshot();
+            it.reset(db_iface->rocksdb_inst->database.db->NewIterator(options));
+            if (overlay_version)
+                it = std::make_unique<rdb::overlay_iterator>(std::move(it), overlay_version);
+        }
+        return *it;
+    }
 
+    virtual bool                       uses_snapshot() override { return true; }
     virtual state_history::fill_status get_fill_status() override { return fill_status; }
 
     virtual std::optional<abieos::checksum256> get_block_id(uint32_t block_num) override {
-        auto rb = rdb::get<kv::received_block>(*it_for_get, kv::make_received_block_key(block_num), false);
+        auto rb = rdb::get<kv::received_block>(iterator(0), kv::make_received_block_key(block_num), false);
         if (rb)
             return rb->block_id;
         return {};
@@ -72,7 +97,31 @@ struct rocksdb_query_session : query_session {
         }
     }
 
-    virtual std::vector<char> query_database(abieos::input_buffer query_bin, uint32_t head) override {
+    // Rows which fail a condition, or which lack the field (e.g. it's inside an absent optional), are skipped
+    bool matches_conditions(const kv::query& query, abieos::input_buffer row, std::vector<std::optional<uint32_t>>& positions) {
+        for (auto& cond : query.conditions) {
+            auto pos = positions.at(cond.field->field_index);
+            if (!pos)
+                return false;
+            abieos::input_buffer bin{row.pos + *pos, row.end};
+            condition_key.clear();
+            cond.field->type_obj->bin_to_key(condition_key, bin);
+            std::string_view actual{condition_key.data(), condition_key.size()};
+            std::string_view expected{cond.value_key.data(), cond.value_key.size()};
+            if (!query_config::test_condition(cond.op_code, actual.compare(expected)))
+                return false;
+        }
+        return true;
+    }
+
+    // The row, if the index entry holds all of it (see covering_fields); otherwise it needs a content lookup
+    static std::optional<abieos::input_buffer> covered_row(abieos::input_buffer index_value) {
+        if (kv::get_covered_tag(index_value) != kv::covered_tag::row)
+            return {};
+        return abieos::input_buffer{index_value.pos + 1, index_value.end};
+    }
+
+    virtual uint32_t query_database(abieos::input_buffer query_bin, uint32_t head, uint32_t& max_block, std::vector<char>& rows) override {
         abieos::name query_name;
         abieos::bin_to_native(query_name, query_bin);
 
@@ -87,8 +136,11 @@ struct rocksdb_query_session : query_session {
             throw std::runtime_error("query_database: query: " + (std::string)query_name + " not implemented");
 
         uint32_t snapshot_block_num = 0;
-        if (query.has_block_snapshot)
-            snapshot_block_num = std::min(head, abieos::bin_to_native<uint32_t>(query_bin));
+        max_block                   = 0xffff'ffff;
+        if (query.has_block_snapshot) {
+            max_block          = abieos::bin_to_native<uint32_t>(query_bin);
+            snapshot_block_num = std::min(head, max_block);
+        }
 
         auto first = kv::make_index_key(query.table_obj->short_name, query.index_obj->short_name);
         auto last  = first;
@@ -102,54 +154,108 @@ struct rocksdb_query_session : query_session {
 
         auto max_results = std::min(abieos::read_raw<uint32_t>(query_bin), query.max_results);
 
-        std::vector<std::vector<char>> rows;
-        uint32_t                       num_results = 0;
-        rdb::for_each_subkey(*it0, first, last, [&](const auto& index_key, auto, auto) {
+        // Join queries keep primary rows aside until the scan is done. Each distinct join key is then looked up once, in key
+        // order, instead of one seek per row.
+        struct pending_row {
+            size_t                   begin       = {};
+            size_t                   end         = {};
+            const std::vector<char>* join_fields = {};
+        };
+        uint32_t                                 num_rows    = 0;
+        uint32_t                                 num_results = 0;
+        std::vector<char>                        pending_data;
+        std::vector<pending_row>                 pending;
+        std::map<std::string, std::vector<char>> joins; // join key -> fields from the join table
+        std::vector<char>                        empty_join;
+        std::vector<std::optional<uint32_t>>     table_positions;
+        if (query.join_table)
+            for (auto& field : query.join_table->fields)
+                field.type_obj->fill_empty(empty_join);
+
+        rdb::for_each_subkey(iterator(1), first, last, [&](const auto& index_key, auto, auto) {
+            bool        skipped               = false;
             std::vector index_key_limit_block = index_key;
             if (query.table_obj->is_delta)
                 kv::append_index_suffix(index_key_limit_block, snapshot_block_num);
             // todo: unify rdb's and pg's handling of negative result because of snapshot_block_num
-            rdb::for_each(*it1, index_key_limit_block, index_key, [&](auto index_value, auto) {
-                auto delta_value =
-                    *rdb::get_raw(*it2, extract_pk_from_index(index_value, *query.table_obj, query.index_obj->sort_keys), true);
-                rows.emplace_back(delta_value.pos, delta_value.end);
-                if (query.join_table) {
-                    auto join_key = kv::make_index_key(query.join_table->short_name, query.join_query_short_name);
-                    std::vector<std::optional<uint32_t>> table_positions;
+            rdb::for_each(iterator(2), index_key_limit_block, index_key, [&](auto index_entry, auto index_value) {
+                auto row = covered_row(index_value);
+                if (!row)
+                    row = rdb::get_raw(iterator(0), extract_pk_from_index(index_entry, *query.table_obj, query.index_obj->sort_keys), true);
+                auto delta_value = *row;
+                if (query.join_table || !query.conditions.empty()) {
                     kv::init_positions(table_positions, query.table_obj->fields.size());
                     fill_positions(delta_value, query.table_obj->fields, table_positions);
-                    bool found_join = false;
-                    if (keys_have_positions(query.join_key_values, table_positions)) {
-                        append_fields(join_key, delta_value, query.join_key_values, table_positions, true);
-                        auto join_key_limit_block = join_key;
-                        if (query.join_query->table_obj->is_delta)
-                            kv::append_index_suffix(join_key_limit_block, snapshot_block_num);
-                        auto& row = rows.back();
-                        rdb::for_each(*it3, join_key_limit_block, join_key, [&](auto join_index_value, auto) {
-                            found_join            = true;
-                            auto join_delta_value = *rdb::get_raw(
-                                *it4, extract_pk_from_index(join_index_value, *query.join_table, query.join_query->index_obj->sort_keys),
-                                true);
-                            std::vector<std::optional<uint32_t>> join_positions;
-                            kv::init_positions(join_positions, query.join_table->fields.size());
-                            fill_positions(join_delta_value, query.join_table->fields, join_positions);
-                            append_fields(row, join_delta_value, query.fields_from_join, join_positions, false);
-                            return false;
-                        });
+                    if (!matches_conditions(query, delta_value, table_positions)) {
+                        skipped = true;
+                        return false;
                     }
-                    if (!found_join)
-                        for (auto& field : query.join_table->fields)
-                            field.type_obj->fill_empty(rows.back());
                 }
+                ++num_rows;
+                if (!query.join_table) {
+                    abieos::push_varuint32(rows, delta_value.end - delta_value.pos);
+                    rows.insert(rows.end(), delta_value.pos, delta_value.end);
+                    return false;
+                }
+                pending_row row{pending_data.size(), 0, &empty_join};
+                pending_data.insert(pending_data.end(), delta_value.pos, delta_value.end);
+                row.end = pending_data.size();
+                if (keys_have_positions(query.join_key_values, table_positions)) {
+                    auto join_key = kv::make_index_key(query.join_table->short_name, query.join_query_short_name);
+                    append_fields(join_key, delta_value, query.join_key_values, table_positions, true);
+                    row.join_fields = &joins[std::string(join_key.begin(), join_key.end())];
+                }
+                pending.push_back(row);
                 return false;
             });
+            if (skipped)
+                return true;
             return ++num_results < max_results;
         });
+        if (!query.join_table)
+            return num_rows;
 
-        auto result = abieos::native_to_bin(rows);
-        if ((uint32_t)result.size() != result.size())
-            throw std::runtime_error("query_database: result is too big");
-        return result;
+        std::vector<std::optional<uint32_t>> join_positions;
+        for (auto& [key, fields] : joins) {
+            std::vector<char> join_key(key.begin(), key.end());
+            auto              join_key_limit_block = join_key;
+            if (query.join_query->table_obj->is_delta)
+                kv::append_index_suffix(join_key_limit_block, snapshot_block_num);
+            bool found_join = false;
+            rdb::for_each(iterator(1), join_key_limit_block, join_key, [&](auto join_index_entry, auto join_index_value) {
+                found_join = true;
+                kv::init_positions(join_positions, query.join_table->fields.size());
+
+                // an entry holding a subset of the row serves the join if it has every field the join needs
+                if (kv::get_covered_tag(join_index_value) == kv::covered_tag::fields) {
+                    abieos::input_buffer covered{join_index_value.pos + 1, join_index_value.end};
+                    kv::fill_covered_positions(covered, query.join_table->fields, join_positions);
+                    if (keys_have_positions(query.fields_from_join, join_positions)) {
+                        append_fields(fields, covered, query.fields_from_join, join_positions, false);
+                        return false;
+                    }
+                    kv::init_positions(join_positions, query.join_table->fields.size());
+                }
+
+                auto join_row = covered_row(join_index_value);
+                if (!join_row) {
+                    auto join_pk = extract_pk_from_index(join_index_entry, *query.join_table, query.join_query->index_obj->sort_keys);
+                    join_row     = rdb::get_raw(iterator(0), join_pk, true);
+                }
+                fill_positions(*join_row, query.join_table->fields, join_positions);
+                append_fields(fields, *join_row, query.fields_from_join, join_positions, false);
+                return false;
+            });
+            if (!found_join)
+                fields = empty_join;
+        }
+
+        for (auto& row : pending) {
+            abieos::push_varuint32(rows, (row.end - row.begin) + row.join_fields->size());
+            rows.insert(rows.end(), pending_data.begin() + row.begin, pending_data.begin() + row.end);
+            rows.insert(rows.end(), row.join_fields->begin(), row.join_fields->end());
+        }
+        return num_rows;
     }
 }; // rocksdb_query_session
 